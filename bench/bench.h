@@ -0,0 +1,136 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+/*
+Minimal harness shared by the component microbenchmarks.
+Each benchmark runs a warmup, then a number of timed repetitions of a fixed number of calls.
+Results are printed as a table and written as JSON (one object per binary) so they can be tracked over time.
+
+Every binary accepts:
+	--reps <n>	Timed repetitions per benchmark (default 10)
+	--warmup <n>	Untimed repetitions per benchmark (default 2)
+	--out <file>	JSON output file (default build/bench_<component>.json)
+*/
+
+// Keeps the compiler from optimizing away a value computed by a benchmark.
+template<typename T>
+inline void do_not_optimize(T const &value) {
+	asm volatile("" : : "r,m"(value) : "memory");
+}
+
+typedef vector<pair<string, double>> BenchParams;
+
+struct BenchResult {
+	string name;
+	BenchParams params;
+	uint64_t iters; // Calls per repetition
+	vector<double> samples; // ns per call of each repetition
+	double mean, stddev, min, median, p90, max;
+};
+
+class BenchSuite {
+	public:
+	BenchSuite(string component, int argc, char *argv[]) : component(component), reps(10), warmup(2) {
+		outFile = "build/bench_" + component + ".json";
+		for (int i = 1; i < argc; i++) {
+			if (strcmp(argv[i], "--reps") == 0 && i + 1 < argc)
+				reps = max(1, atoi(argv[++i]));
+			else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc)
+				warmup = atoi(argv[++i]);
+			else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+				outFile = argv[++i];
+			else {
+				cout << "Usage: " << argv[0] << " [--reps <n>] [--warmup <n>] [--out <file>]" << endl;
+				exit(2);
+			}
+		}
+		cout << "== " << component << " ==" << endl;
+	}
+
+	~BenchSuite() { writeJSON(); }
+
+	// Times iters calls of fn per repetition. fn receives the call number.
+	template<typename F>
+	void run(string name, BenchParams params, uint64_t iters, F fn) {
+		BenchResult r;
+		r.name = name;
+		r.params = params;
+		r.iters = iters;
+		for (int rep = 0; rep < warmup + reps; rep++) {
+			auto start = chrono::high_resolution_clock::now();
+			for (uint64_t i = 0; i < iters; i++)
+				fn(i);
+			auto end = chrono::high_resolution_clock::now();
+			if (rep >= warmup)
+				r.samples.push_back(chrono::duration<double, nano>(end - start).count() / iters);
+		}
+		summarize(r);
+		print(r);
+		results.push_back(r);
+	}
+
+	// Result of the most recent run call.
+	const BenchResult &last() const { return results.back(); }
+
+	private:
+	static void summarize(BenchResult &r) {
+		vector<double> s(r.samples);
+		sort(s.begin(), s.end());
+		double sum = 0, sq = 0;
+		for (double v : s)
+			sum += v;
+		r.mean = sum / s.size();
+		for (double v : s)
+			sq += (v - r.mean) * (v - r.mean);
+		r.stddev = s.size() > 1 ? sqrt(sq / (s.size() - 1)) : 0;
+		r.min = s.front();
+		r.max = s.back();
+		r.median = s[s.size() / 2];
+		r.p90 = s[min(s.size() - 1, (size_t) (0.9 * (s.size() - 1) + 0.5))];
+	}
+
+	static void print(const BenchResult &r) {
+		cout << r.name;
+		for (auto &p : r.params)
+			cout << " " << p.first << "=" << p.second;
+		cout << ": median " << r.median << " ns, mean " << r.mean << " ns (+/- " << r.stddev << "), min " << r.min << " ns, max " << r.max << " ns" << endl;
+	}
+
+	void writeJSON() {
+		ofstream out(outFile);
+		if (!out) {
+			cout << "Could not write " << outFile << endl;
+			return;
+		}
+		out << "{\n  \"component\": \"" << component << "\",\n  \"timestamp\": " << time(nullptr)
+			  << ",\n  \"reps\": " << reps << ",\n  \"warmup\": " << warmup << ",\n  \"results\": [";
+		for (size_t i = 0; i < results.size(); i++) {
+			const BenchResult &r = results[i];
+			out << (i ? ",\n" : "\n") << "    {\"name\": \"" << r.name << "\", \"params\": {";
+			for (size_t p = 0; p < r.params.size(); p++)
+				out << (p ? ", " : "") << "\"" << r.params[p].first << "\": " << r.params[p].second;
+			out << "}, \"iters\": " << r.iters << ", \"ns_per_op\": {\"mean\": " << r.mean << ", \"stddev\": " << r.stddev
+				  << ", \"min\": " << r.min << ", \"median\": " << r.median << ", \"p90\": " << r.p90 << ", \"max\": " << r.max << "}}";
+		}
+		out << "\n  ]\n}\n";
+		cout << "Results written to " << outFile << endl;
+	}
+
+	string component;
+	string outFile;
+	int reps;
+	int warmup;
+	vector<BenchResult> results;
+};
@@ -0,0 +1,55 @@
+#include <random>
+
+#include "bench.h"
+#include "utils.h"
+
+/*
+FindCutoff against the scalar reference, for PartNum from 2^8 to 2^16.
+Every cutoff is checked to be bit-identical to the reference, on uniform PRF values as well as on narrow-range values that exercise the duplicate path.
+*/
+
+#define NUM_ARRAYS 256
+
+// Returns the cutoffs find computes for every array in vals.
+template<typename F>
+vector<uint32_t> cutoffs(F find, vector<uint32_t> vals, uint32_t PartNum)
+{
+	vector<uint32_t> result(NUM_ARRAYS);
+	for (uint32_t a = 0; a < NUM_ARRAYS; a++)
+		result[a] = find(vals.data() + a * PartNum, PartNum);
+	return result;
+}
+
+int main(int argc, char *argv[])
+{
+	BenchSuite suite("find_cutoff", argc, argv);
+	mt19937 gen(42);
+	for (uint32_t LogPartNum = 8; LogPartNum <= 16; LogPartNum++){
+		uint32_t PartNum = 1 << LogPartNum;
+		vector<uint32_t> uniform(NUM_ARRAYS * PartNum), narrow(NUM_ARRAYS * PartNum);
+		for (uint32_t i = 0; i < uniform.size(); i++){
+			uniform[i] = gen();
+			narrow[i] = 0x80000000u + (gen() % (2 * PartNum)) - PartNum;
+		}
+		if (cutoffs(FindCutoff, uniform, PartNum) != cutoffs(FindCutoffScalar, uniform, PartNum) ||
+				cutoffs(FindCutoff, narrow, PartNum) != cutoffs(FindCutoffScalar, narrow, PartNum)){
+			cout << "FindCutoff does not match the reference, PartNum " << PartNum << endl;
+			return 1;
+		}
+
+		// FindCutoff overwrites its input, so every call gets a fresh copy. The copy is timed separately.
+		vector<uint32_t> scratch(PartNum);
+		suite.run("copy", {{"PartNum", PartNum}}, NUM_ARRAYS, [&](uint64_t i){
+			memcpy(scratch.data(), uniform.data() + i * PartNum, PartNum * sizeof(uint32_t));
+			do_not_optimize(scratch[0]);
+		});
+		suite.run("FindCutoffScalar", {{"PartNum", PartNum}}, NUM_ARRAYS, [&](uint64_t i){
+			memcpy(scratch.data(), uniform.data() + i * PartNum, PartNum * sizeof(uint32_t));
+			do_not_optimize(FindCutoffScalar(scratch.data(), PartNum));
+		});
+		suite.run("FindCutoff", {{"PartNum", PartNum}}, NUM_ARRAYS, [&](uint64_t i){
+			memcpy(scratch.data(), uniform.data() + i * PartNum, PartNum * sizeof(uint32_t));
+			do_not_optimize(FindCutoff(scratch.data(), PartNum));
+		});
+	}
+}
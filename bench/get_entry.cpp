@@ -0,0 +1,29 @@
+#include <random>
+
+#include "bench.h"
+#include "utils.h"
+
+/*
+getEntryFromDB on random indices, for a few database and entry sizes.
+*/
+
+int main(int argc, char *argv[])
+{
+	BenchSuite suite("get_entry", argc, argv);
+	mt19937 gen(42);
+	uint32_t configs[][2] = {{16, 32}, {20, 8}, {20, 32}, {20, 256}, {24, 32}};
+	for (auto &config : configs){
+		uint32_t LogN = config[0], EntrySize = config[1];
+		uint64_t *DB;
+		initDatabase(&DB, LogN, EntrySize);
+		vector<uint32_t> indices(1 << 14);
+		for (auto &index : indices)
+			index = gen() & ((1u << LogN) - 1);
+		vector<uint64_t> entry(EntrySize / 8);
+		suite.run("getEntryFromDB", {{"LogN", LogN}, {"EntrySize", EntrySize}}, indices.size(), [&](uint64_t i){
+			getEntryFromDB(DB, indices[i], entry.data(), EntrySize);
+			do_not_optimize(entry[0]);
+		});
+		delete [] DB;
+	}
+}
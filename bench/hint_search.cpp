@@ -0,0 +1,37 @@
+#include <random>
+
+#include "bench.h"
+#include "client.h"
+
+/*
+Client side search for a hint containing a random query index.
+*/
+
+int main(int argc, char *argv[])
+{
+	BenchSuite suite("hint_search", argc, argv);
+	mt19937 gen(42);
+	uint32_t EntrySize = 32;
+	for (uint32_t LogN = 16; LogN <= 20; LogN += 2){
+		uint64_t *DB;
+		initDatabase(&DB, LogN, EntrySize);
+		vector<uint32_t> queries(256);
+		for (auto &query : queries)
+			query = gen() & ((1u << LogN) - 1);
+
+		OneSVServer one_server(DB, LogN, EntrySize);
+		OneSVClient one_client(LogN, EntrySize);
+		one_client.Offline(one_server);
+		suite.run("OneSVClient::FindHint", {{"LogN", LogN}, {"EntrySize", EntrySize}}, queries.size(), [&](uint64_t i){
+			do_not_optimize(one_client.FindHint(queries[i]));
+		});
+
+		TwoSVServer two_server(DB, LogN, EntrySize);
+		TwoSVClient two_client(LogN, EntrySize);
+		two_client.Offline(two_server);
+		suite.run("TwoSVClient::FindHint", {{"LogN", LogN}, {"EntrySize", EntrySize}}, queries.size(), [&](uint64_t i){
+			do_not_optimize(two_client.FindHint(queries[i]));
+		});
+		delete [] DB;
+	}
+}
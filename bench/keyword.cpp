@@ -0,0 +1,64 @@
+#include <random>
+
+#include "bench.h"
+#include "keyword.h"
+
+/*
+Cost of a key lookup against the cost of a plain index query, for both variants.
+The databases hold a cuckoo layout filled to 85% with random 64-bit keys. A lookup makes KEY_HASHES index queries.
+The client is set up once per size, so the iterations are kept low enough for the one server variant not to run out of backup hints.
+*/
+
+int main(int argc, char *argv[])
+{
+	BenchSuite suite("keyword", argc, argv);
+	mt19937_64 gen(42);
+	uint32_t EntrySize = 32;
+	for (uint32_t LogN = 16; LogN <= 20; LogN += 2){
+		uint64_t N = 1ull << LogN;
+		uint64_t Count = N * 85 / 100;
+		CuckooLayout layout(LogN, EntrySize);
+		vector<uint64_t> Keys(Count), Values(Count * layout.valueWords());
+		for (uint64_t &key : Keys)
+			key = gen();
+		DBGenerator dbgen(EntrySize - 8);
+		dbgen.fillRange(Values.data(), 0, Count);
+		uint64_t *DB;
+		bool built = initKeywordDatabase(&DB, layout, Keys.data(), Values.data(), Count);
+		assert(built);
+
+		KeywordClient keyword(layout);
+		vector<uint64_t> entry(EntrySize / 8), value(layout.valueWords());
+		uint64_t iters = 32;
+		BenchParams params = {{"LogN", LogN}, {"EntrySize", EntrySize}};
+
+		OneSVServer one_server(DB, LogN, EntrySize);
+		OneSVClient one_client(LogN, EntrySize);
+		one_client.Offline(one_server);
+		suite.run("OneSVClient::Online", params, iters, [&](uint64_t){
+			one_client.Online(one_server, gen() & (N - 1), entry.data());
+			do_not_optimize(entry[0]);
+		});
+		suite.run("KeywordClient::Lookup (one server)", params, iters, [&](uint64_t){
+			uint64_t k = gen() % Count;
+			bool found = keyword.Lookup(one_client, one_server, Keys[k], value.data());
+			assert(found && memcmp(value.data(), &Values[k * layout.valueWords()], EntrySize - 8) == 0);
+			do_not_optimize(value[0]);
+		});
+
+		TwoSVServer two_server(DB, LogN, EntrySize);
+		TwoSVClient two_client(LogN, EntrySize);
+		two_client.Offline(two_server);
+		suite.run("TwoSVClient::Online", params, iters, [&](uint64_t){
+			two_client.Online(two_server, two_server, gen() & (N - 1), entry.data());
+			do_not_optimize(entry[0]);
+		});
+		suite.run("KeywordClient::Lookup (two server)", params, iters, [&](uint64_t){
+			uint64_t k = gen() % Count;
+			bool found = keyword.Lookup(two_client, two_server, two_server, Keys[k], value.data());
+			assert(found && memcmp(value.data(), &Values[k * layout.valueWords()], EntrySize - 8) == 0);
+			do_not_optimize(value[0]);
+		});
+		delete [] DB;
+	}
+}
@@ -0,0 +1,143 @@
+#include <cstdio>
+#include <random>
+#include <unistd.h>
+
+#include "bench.h"
+#include "client.h"
+#include "metrics.h"
+
+/*
+Cost of the built-in metrics: the update primitives on their own, and whole online queries against a baseline built with -DS3PIR_NO_METRICS.
+make bench builds that baseline as bench_metrics_off next to this binary. The comparison alternates rounds of the two builds,
+one baseline process per round, so drift in machine state affects both alike. Rounds are the unit of the statistics since samples within
+a process share its memory layout. It reports the overhead with a 95% confidence interval and fails if it is significantly above 1%.
+On a noisy machine that interval is often too wide to resolve 1%, so it also reports an analytic bound: the measured cost of each update
+primitive times the updates a query makes, counted from the metrics themselves, over the time per query. It fails if that bound is not below 1%.
+*/
+
+#define ROUNDS 10 // Alternating rounds of the two builds per database size
+#define T_CRIT 2.262 // 97.5% quantile of Student's t with ROUNDS - 1 degrees of freedom
+#define SAMPLES 5 // Samples per round
+#define SAMPLE_QUERIES 128 // Online queries per sample
+#define MAX_OVERHEAD 1.0 // Target overhead in percent
+
+// Sets up a fresh client, runs a warmup and returns SAMPLES measurements of the time per online query in ns.
+// The queries are seeded, so both builds run the same queries.
+vector<double> measure_online(uint32_t LogN)
+{
+	uint32_t EntrySize = 32;
+	mt19937 gen(42);
+	srand(42);
+	uint64_t *DB;
+	initDatabase(&DB, LogN, EntrySize);
+	TwoSVServer server(DB, LogN, EntrySize);
+	TwoSVClient client(LogN, EntrySize);
+	client.Offline(server);
+	vector<uint64_t> result(EntrySize / 8);
+	vector<double> samples;
+	for (uint32_t s = 0; s < SAMPLES + 2; s++){
+		auto start = chrono::high_resolution_clock::now();
+		for (uint32_t q = 0; q < SAMPLE_QUERIES; q++){
+			client.Online(server, server, gen() & ((1u << LogN) - 1), result.data());
+			do_not_optimize(result[0]);
+		}
+		auto end = chrono::high_resolution_clock::now();
+		if (s >= 2)	// warmup
+			samples.push_back(chrono::duration<double, nano>(end - start).count() / SAMPLE_QUERIES);
+	}
+	delete [] DB;
+	return samples;
+}
+
+double mean(const vector<double> &v)
+{
+	double sum = 0;
+	for (double x : v)
+		sum += x;
+	return sum / v.size();
+}
+
+int main(int argc, char *argv[])
+{
+	// bench_metrics_off --samples <LogN> prints the samples of one round for the comparison, one "sample <ns>" line each
+	if (argc == 3 && strcmp(argv[1], "--samples") == 0){
+		for (double sample : measure_online(atoi(argv[2])))
+			cout << "sample " << sample << endl;
+		return 0;
+	}
+#ifdef S3PIR_NO_METRICS
+	cout << "This is the baseline of bench_metrics, run bench_metrics instead" << endl;
+	return 2;
+#else
+	string baseline = string(argv[0]) + "_off";
+	BenchSuite suite("metrics", argc, argv);
+
+	suite.run("Metrics::add", {}, 1 << 20, [&](uint64_t i){
+		METRICS_ADD(HintsScanned, i);
+	});
+	double add_ns = suite.last().median;
+	suite.run("Metrics::time", {}, 1 << 20, [&](uint64_t i){
+		METRICS_TIME(ClientAnswer, i);
+	});
+	double time_ns = suite.last().median;
+	suite.run("ScopedTimer", {}, 1 << 20, [&](uint64_t i){
+		METRICS_SCOPED_TIMER(ServerAnswer);
+		do_not_optimize(i);
+	});
+	double scoped_ns = suite.last().median;
+	bool failed = false;
+
+	// Updates of one TwoSVClient::Online call: two adds per hint search, a time per client stage,
+	// a scoped timer and an add answering, and a scoped timer and two adds replenishing
+	for (uint32_t LogN = 16; LogN <= 20; LogN += 2){
+		Metrics::reset();
+		double ns = mean(measure_online(LogN));
+		Metrics::Snapshot m = Metrics::snapshot();
+		double queries = m.timerCount[Metrics::ClientGenerate];
+		double adds = 2.0 * m.counters[Metrics::HintSearches] + m.timerCount[Metrics::ServerAnswer] + 2.0 * m.timerCount[Metrics::ServerReplenish];
+		double times = m.timerCount[Metrics::ClientGenerate] + m.timerCount[Metrics::ClientAnswer] + m.timerCount[Metrics::ClientReplenish];
+		double scoped = m.timerCount[Metrics::ServerAnswer] + m.timerCount[Metrics::ServerReplenish];
+		double bound = (adds * add_ns + times * time_ns + scoped * scoped_ns) / queries / ns * 100;
+		failed |= bound >= MAX_OVERHEAD;
+		cout << "TwoSVClient::Online LogN=" << LogN << ": " << adds / queries << " adds, " << times / queries << " times, " << scoped / queries
+			<< " scoped timers per query of " << ns << " ns, analytic overhead " << bound << "%, target < " << MAX_OVERHEAD << "%: " << (bound < MAX_OVERHEAD ? "PASS" : "FAIL") << endl;
+	}
+
+	if (access(baseline.c_str(), X_OK) != 0){
+		cout << "No baseline build at " << baseline << ", skipping the measured online query overhead" << endl;
+		return failed;
+	}
+	for (uint32_t LogN = 16; LogN <= 20; LogN += 2){
+		vector<double> on, off, diff; // Mean time per query of each round, and their differences
+		for (uint32_t round = 0; round < ROUNDS; round++){
+			vector<double> base;
+			FILE *child = popen((baseline + " --samples " + to_string(LogN)).c_str(), "r");
+			// The offline phase prints progress lines of its own
+			char line[256];
+			double sample;
+			while (child && fgets(line, sizeof(line), child))
+				if (sscanf(line, "sample %lf", &sample) == 1)
+					base.push_back(sample);
+			if (!child || pclose(child) != 0 || base.size() != SAMPLES){
+				cout << "Baseline " << baseline << " failed" << endl;
+				return 1;
+			}
+			off.push_back(mean(base));
+			on.push_back(mean(measure_online(LogN)));
+			diff.push_back(on.back() - off.back());
+		}
+		// Paired t interval of the difference per round, relative to the baseline
+		double mean_on = mean(on), mean_off = mean(off), mean_diff = mean(diff), var = 0;
+		for (double d : diff)
+			var += (d - mean_diff) * (d - mean_diff);
+		var /= ROUNDS - 1;
+		double overhead = mean_diff / mean_off * 100;
+		double ci = T_CRIT * sqrt(var / ROUNDS) / mean_off * 100;
+		string verdict = overhead + ci < MAX_OVERHEAD ? "PASS" : overhead - ci > MAX_OVERHEAD ? "FAIL" : "INCONCLUSIVE";
+		failed |= verdict == "FAIL";
+		cout << "TwoSVClient::Online LogN=" << LogN << ": " << mean_on << " ns with metrics, " << mean_off << " ns without, overhead "
+			<< overhead << "% +/- " << ci << "% (95%), target < " << MAX_OVERHEAD << "%: " << verdict << endl;
+	}
+	return failed;
+#endif
+}
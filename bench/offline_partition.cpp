@@ -0,0 +1,24 @@
+#include "bench.h"
+#include "client.h"
+
+/*
+One server offline phase: updating all M + M/2 hint parities with one streamed partition.
+*/
+
+int main(int argc, char *argv[])
+{
+	BenchSuite suite("offline_partition", argc, argv);
+	uint32_t EntrySize = 32;
+	for (uint32_t LogN = 16; LogN <= 20; LogN += 2){
+		uint32_t PartNum = 1 << (LogN / 2);
+		uint64_t *DB;
+		initDatabase(&DB, LogN, EntrySize);
+		OneSVServer server(DB, LogN, EntrySize);
+		OneSVClient client(LogN, EntrySize);
+		client.Offline(server);
+		suite.run("OneSVClient::ProcessPartition", {{"LogN", LogN}, {"EntrySize", EntrySize}}, 4, [&](uint64_t i){
+			client.ProcessPartition(i % PartNum);
+		});
+		delete [] DB;
+	}
+}
@@ -0,0 +1,44 @@
+#include <random>
+
+#include "bench.h"
+#include "server.h"
+
+/*
+Server side of an online query: gathering and xoring PartNum entries chosen by random select bits and offsets.
+*/
+
+int main(int argc, char *argv[])
+{
+	BenchSuite suite("online_query", argc, argv);
+	mt19937 gen(42);
+	uint32_t EntrySize = 32;
+	for (uint32_t LogN = 16; LogN <= 22; LogN += 2){
+		uint32_t PartNum = 1 << (LogN / 2);
+		uint32_t PartSize = 1 << (LogN / 2 + LogN % 2);
+		uint64_t *DB;
+		initDatabase(&DB, LogN, EntrySize);
+		OneSVServer one_server(DB, LogN, EntrySize);
+		TwoSVServer two_server(DB, LogN, EntrySize);
+
+		// A pool of random queries to cycle through
+		uint32_t NumQueries = 64;
+		vector<uint32_t> Svec(NumQueries * PartNum);
+		bool *bvec = new bool [NumQueries * PartNum];
+		for (uint32_t i = 0; i < NumQueries * PartNum; i++){
+			Svec[i] = gen() & (PartSize - 1);
+			bvec[i] = gen() & 1;
+		}
+		vector<uint64_t> b0(EntrySize / 8), b1(EntrySize / 8);
+
+		suite.run("OneSVServer::onlineQuery", {{"LogN", LogN}, {"EntrySize", EntrySize}}, NumQueries, [&](uint64_t i){
+			one_server.onlineQuery(bvec + i * PartNum, Svec.data() + i * PartNum, b0.data(), b1.data());
+			do_not_optimize(b0[0]);
+		});
+		suite.run("TwoSVServer::onlineQuery", {{"LogN", LogN}, {"EntrySize", EntrySize}}, NumQueries, [&](uint64_t i){
+			two_server.onlineQuery(bvec + i * PartNum, Svec.data() + i * PartNum, b0.data(), b1.data());
+			do_not_optimize(b0[0]);
+		});
+		delete [] bvec;
+		delete [] DB;
+	}
+}
@@ -0,0 +1,43 @@
+#include "bench.h"
+#include "utils.h"
+
+/*
+PRF evaluation: single blocks through both PRF classes, and batched expansion of all PRF rows of a hint,
+in the compact 16-bit offset layout and the wide layout of databases larger than 2^32 entries.
+*/
+
+int main(int argc, char *argv[])
+{
+	BenchSuite suite("prf", argc, argv);
+	PRFPartitionID prfPart(AES_KEY);
+	PRFHintID prfHint(AES_KEY);
+	uint32_t out[4];
+
+	suite.run("PRFPartitionID::evaluate", {}, 1 << 16, [&](uint64_t i){
+		prfPart.evaluate((uint8_t*) out, i, i >> 2, 1);
+		do_not_optimize(out[0]);
+	});
+	suite.run("PRFHintID::PRF4Select", {}, 1 << 16, [&](uint64_t i){
+		do_not_optimize(prfHint.PRF4Select(i, i & 1023, 0x80000000));
+	});
+
+	for (int wide = 0; wide < 2; wide++){
+		prfPart.setWide(wide);
+		prfHint.setWide(wide);
+		suite.run("PRFHintID::PRF4Idx", {{"Wide", wide}}, 1 << 16, [&](uint64_t i){
+			do_not_optimize(prfHint.PRF4Idx(i, i & 1023));
+		});
+		for (uint32_t LogPartNum = 8; LogPartNum <= 16; LogPartNum += 2){
+			uint32_t PartNum = 1 << LogPartNum;
+			vector<uint32_t> selectVals(PartNum), offsets(PartNum), blockIn(4 * PartNum), blockOut(4 * PartNum);
+			suite.run("PRFPartitionID::expandHint", {{"PartNum", PartNum}, {"Wide", wide}}, 64, [&](uint64_t i){
+				prfPart.expandHint(i, PartNum, selectVals.data(), offsets.data(), blockIn.data(), blockOut.data());
+				do_not_optimize(offsets[0]);
+			});
+			suite.run("PRFHintID::expandHint", {{"PartNum", PartNum}, {"Wide", wide}}, 64, [&](uint64_t i){
+				prfHint.expandHint(i, PartNum, selectVals.data(), offsets.data(), blockIn.data(), blockOut.data());
+				do_not_optimize(offsets[0]);
+			});
+		}
+	}
+}
@@ -0,0 +1,25 @@
+#include "bench.h"
+#include "server.h"
+
+/*
+Offline server side of hint replenishment in the two server variant: one PRF expansion, one FindCutoff and PartNum entry reads.
+*/
+
+int main(int argc, char *argv[])
+{
+	BenchSuite suite("replenish_hint", argc, argv);
+	uint32_t EntrySize = 32;
+	for (uint32_t LogN = 16; LogN <= 22; LogN += 2){
+		uint64_t *DB;
+		initDatabase(&DB, LogN, EntrySize);
+		TwoSVServer server(DB, LogN, EntrySize);
+		vector<uint64_t> parities(2 * EntrySize / 8);
+		uint32_t cutoff;
+		uint64_t M = (uint64_t) LAMBDA << (LogN - LogN / 2); // Offline hints use IDs 0 to M - 1, replenished ones follow like LastHintID
+		suite.run("TwoSVServer::replenishHint", {{"LogN", LogN}, {"EntrySize", EntrySize}}, 64, [&](uint64_t i){
+			server.replenishHint(M + i, parities.data(), &cutoff);
+			do_not_optimize(parities[0]);
+		});
+		delete [] DB;
+	}
+}
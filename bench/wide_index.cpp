@@ -0,0 +1,92 @@
+#include <random>
+
+#include "bench.h"
+#include "client.h"
+#include "server.h"
+#include "query.h"
+
+/*
+Online and replenishment costs of the wide index layout, up to a database of 2^34 entries.
+The servers recompute every entry they read from a DBGenerator, so no database is stored.
+The offline phase streams the whole database and is left out, it takes hours at this size.
+LogN 30 is run in both layouts to isolate the cost of the wide layout from the cost of the larger database.
+The one server client streams the database in its offline phase, so its whole online query is run at LogN 20 in both layouts instead.
+*/
+
+int main(int argc, char *argv[])
+{
+	BenchSuite suite("wide_index", argc, argv);
+	mt19937 gen(42);
+	uint32_t EntrySize = 32;
+	DBGenerator dbgen(EntrySize);
+	struct Config { uint32_t LogN; bool Wide; };
+	for (Config c : {Config{30, false}, Config{30, true}, Config{32, true}, Config{34, true}}){
+		uint32_t LogN = c.LogN;
+		uint32_t PartNum = 1 << (LogN / 2);
+		uint32_t PartSize = 1 << (LogN / 2 + LogN % 2);
+		BenchParams params = {{"LogN", LogN}, {"EntrySize", EntrySize}, {"Wide", c.Wide}};
+		TwoSVServer server(nullptr, LogN, EntrySize, nullptr, &dbgen, Geometry(0, 0, c.Wide));
+		OneSVServer one_server(nullptr, LogN, EntrySize, nullptr, &dbgen, Geometry(0, 0, c.Wide));
+		PRFPartitionID prf(AES_KEY);
+		prf.setWide(c.Wide || LogN > 31);
+		PRFHintID one_prf(AES_KEY);
+		one_prf.setWide(c.Wide || LogN > 31);
+
+		suite.run("PRFPartitionID::PRF4Idx", params, 1 << 14, [&](uint64_t i){
+			do_not_optimize(prf.PRF4Idx(i, i & (PartNum - 1)));
+		});
+		suite.run("PRFHintID::PRF4Idx", params, 1 << 14, [&](uint64_t i){
+			do_not_optimize(one_prf.PRF4Idx(i, i & (PartNum - 1)));
+		});
+
+		Arena arena;
+		QueryBuilder builder;
+		builder.init(arena, PartNum, PartSize);
+		bool *bvec = arena.alloc<bool>(PartNum);
+		uint32_t *Svec = arena.alloc<uint32_t>(PartNum);
+		uint64_t dummyIdxUsed = 0;
+		suite.run("QueryBuilder::build", params, 16, [&](uint64_t i){
+			builder.expand(prf, i);
+			builder.drawDummies(prf, dummyIdxUsed);
+			builder.build(0x80000000, 0, i & 1, 0, gen() & (PartNum - 1), ((uint64_t) gen() << 32 | gen()) & (((uint64_t) 1 << LogN) - 1), bvec, Svec);
+			do_not_optimize(Svec[0]);
+		});
+
+		vector<uint64_t> b0(EntrySize / 8), b1(EntrySize / 8);
+		suite.run("TwoSVServer::onlineQuery", params, 4, [&](uint64_t){
+			server.onlineQuery(bvec, Svec, b0.data(), b1.data());
+			do_not_optimize(b0[0]);
+		});
+		suite.run("OneSVServer::onlineQuery", params, 4, [&](uint64_t){
+			one_server.onlineQuery(bvec, Svec, b0.data(), b1.data());
+			do_not_optimize(b0[0]);
+		});
+
+		vector<uint64_t> parities(2 * EntrySize / 8);
+		uint32_t cutoff;
+		uint64_t M = (uint64_t) LAMBDA * PartSize; // First replenished hint ID, see LastHintID
+		suite.run("TwoSVServer::replenishHint", params, 4, [&](uint64_t i){
+			server.replenishHint(M + i, parities.data(), &cutoff);
+			do_not_optimize(parities[0]);
+		});
+	}
+
+	// Whole one server queries, checked against the database
+	uint32_t LogN = 20;
+	uint64_t *DB;
+	initDatabase(&DB, LogN, EntrySize);
+	for (bool Wide : {false, true}){
+		BenchParams params = {{"LogN", LogN}, {"EntrySize", EntrySize}, {"Wide", Wide}};
+		OneSVServer server(DB, LogN, EntrySize, nullptr, nullptr, Geometry(0, 0, Wide));
+		OneSVClient client(LogN, EntrySize, Geometry(0, 0, Wide));
+		client.Offline(server);
+		vector<uint64_t> result(EntrySize / 8), expected(EntrySize / 8);
+		suite.run("OneSVClient::Online", params, 16, [&](uint64_t){
+			uint64_t query = gen() & ((1 << LogN) - 1);
+			client.Online(server, query, result.data());
+			server.getEntry(query, expected.data());
+			assert(result == expected);
+		});
+	}
+	delete [] DB;
+}
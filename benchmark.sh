@@ -3,6 +3,8 @@
 simulate_large_server=0
 benchmark_size=SMALL
 output_file=build/output.csv
+reps=0
+sweep_file=build/sweep.csv
 
 function print_usage()
 {
@@ -11,16 +13,19 @@ function print_usage()
   printf "Options:\n"
   printf "  -s                          Run with a simulated large server to reduce memory requirements.\n"
   printf "  -b SMALL / LARGE / FULL     Run the small / large / full benchmark. Small: ~5 mins. Large: ~1 hrs. Full: ~2 hrs. \n"
+  printf "  -r REPS                     Run each configuration REPS times, one s3pir process per grid of sizes, and save means and confidence intervals in build/sweep.csv.\n"
   printf "  -h                          Display this help message and exit.\n"
 }
 
-while getopts sb:h option
+while getopts sb:r:h option
 do 
     case "${option}" in
         s) 
           simulate_large_server=1;;
         b) 
           benchmark_size=${OPTARG};;
+        r) 
+          reps=${OPTARG};;
         ? | h)
           print_usage
           exit 2;;
@@ -45,6 +50,29 @@ function run_two_server ()
   fi
 }
 
+function s3pir_exec()
+{
+  if [[ "$simulate_large_server" -eq 1 ]]; then
+    echo build/s3pir_simlargeserver
+  else 
+    echo build/s3pir
+  fi
+}
+
+# Runs every combination of the comma separated Log2 DB sizes ($2) and entry sizes ($3) with the one or two server variant ($1)
+function run_grid ()
+{
+  if [[ "$reps" -gt 0 ]]; then
+    $(s3pir_exec) --sweep $1 $2 $3 "$sweep_file" --reps $reps
+    return
+  fi
+  for n in ${2//,/ }; do
+    for e in ${3//,/ }; do
+      run_${1}_server $n $e "$output_file"
+    done
+  done
+}
+
 function make_exec()
 {
   if [[ "$simulate_large_server" -eq 1 ]]; then
@@ -52,41 +80,30 @@ function make_exec()
   fi
   mkdir -p build
   find build -name output.csv -delete
+  find build -name sweep.csv -delete
   make
 }
 
 function small_params()
 {
-  run_one_server 20 32 "$output_file" 
-  run_one_server 24 32 "$output_file" 
-  run_two_server 20 32 "$output_file" 
-  run_two_server 24 32 "$output_file" 
+  run_grid one 20,24 32
+  run_grid two 20,24 32
 }
 
 function large_params()
 {
-  run_one_server 20 32 "$output_file" 
-  run_one_server 24 32 "$output_file" 
-  run_one_server 28 8 "$output_file" 
-  run_one_server 28 32 "$output_file" 
-  run_two_server 20 32 "$output_file" 
-  run_two_server 24 32 "$output_file" 
-  run_two_server 28 8 "$output_file" 
-  run_two_server 28 32 "$output_file" 
+  run_grid one 20,24 32
+  run_grid one 28 8,32
+  run_grid two 20,24 32
+  run_grid two 28 8,32
 }
 
 function full_params()
 {
-  run_one_server 20 32 "$output_file" 
-  run_one_server 24 32 "$output_file" 
-  run_one_server 28 8 "$output_file" 
-  run_one_server 28 32 "$output_file" 
-  run_one_server 28 256 "$output_file" 
-  run_two_server 20 32 "$output_file" 
-  run_two_server 24 32 "$output_file" 
-  run_two_server 28 8 "$output_file" 
-  run_two_server 28 32 "$output_file" 
-  run_two_server 28 256 "$output_file" 
+  run_grid one 20,24 32
+  run_grid one 28 8,32,256
+  run_grid two 20,24 32
+  run_grid two 28 8,32,256
 }
 
 
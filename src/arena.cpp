@@ -0,0 +1,63 @@
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <sys/mman.h>
+
+#include "arena.h"
+
+#define ARENA_BLOCK (1 << 20) // Size of a shared block for small allocations
+#define HUGE_PAGE (1 << 21)
+
+Arena::~Arena() {
+	for (size_t i = 0; i < blocks.size(); i++)
+		munmap(blocks[i].base, blocks[i].size);
+}
+
+Arena::Block Arena::newBlock(size_t size) {
+	size_t page = size >= HUGE_PAGE ? HUGE_PAGE : 4096;
+	size = (size + page - 1) & ~(page - 1);
+	void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		std::cout << "Arena: failed to allocate " << size << " bytes" << std::endl;
+		exit(1);
+	}
+#ifdef MADV_HUGEPAGE
+	if (page == HUGE_PAGE)
+		madvise(p, size, MADV_HUGEPAGE);
+#endif
+	// Touch every page from this thread so the kernel places it on our NUMA node.
+	memset(p, 0, size);
+	Block b = {(uint8_t*) p, size};
+	blocks.push_back(b);
+	return b;
+}
+
+void *Arena::allocBytes(size_t size, size_t align) {
+	assert(align >= 64 && (align & (align - 1)) == 0);
+	if (size == 0)
+		size = 1;
+
+	// Large requests get their own block, which is page aligned.
+	if (size + align > ARENA_BLOCK / 4) {
+		assert(align <= 4096 || size >= HUGE_PAGE);
+		return newBlock(size).base;
+	}
+
+	uintptr_t start = ((uintptr_t) cur + align - 1) & ~(uintptr_t) (align - 1);
+	if (cur == nullptr || start + size > (uintptr_t) cur + curLeft) {
+		Block b = newBlock(ARENA_BLOCK);
+		cur = b.base;
+		curLeft = b.size;
+		start = ((uintptr_t) cur + align - 1) & ~(uintptr_t) (align - 1);
+	}
+	curLeft -= start + size - (uintptr_t) cur;
+	cur = (uint8_t*) (start + size);
+	return (void*) start;
+}
+
+size_t Arena::bytesReserved() const {
+	size_t total = 0;
+	for (size_t i = 0; i < blocks.size(); i++)
+		total += blocks[i].size;
+	return total;
+}
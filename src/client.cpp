@@ -1,133 +1,184 @@
 #include "client.h"
 #include "server.h"
+#include "metrics.h"
 #include <random>
 #include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <thread>
 
 using namespace std;
 using namespace CryptoPP;
 
-// N is supported up to 2^32. Allows us to use uint16_t to store a single offset within partition
-TwoSVClient::TwoSVClient(uint32_t LogN, uint32_t EntryB):
+// Up to N = 2^31 an offset within a partition fits in 16 bits and an extra entry in 31 bits, larger databases switch to the wide layout.
+TwoSVClient::TwoSVClient(uint32_t LogN, uint32_t EntryB, Geometry geo):
  prf(AES_KEY) {
-	assert(LogN < 32);
+	assert(LogN <= MAX_LOG_N);
 	assert(EntryB >= 8);
-	N = 1 << LogN;
+	N = (uint64_t) 1 << LogN;
+	geo = geo.resolve(LogN);
+	prf.setWide(geo.Wide);
 	// B is the size of one entry in uint64s
 	B = EntryB / 8;
 
-	PartNum = 1 << (LogN / 2);
-	PartSize = 1 << (LogN / 2 + LogN % 2);
-	lambda = LAMBDA;
+	PartNum = 1u << geo.LogPartNum;
+	PartSize = 1u << (LogN - geo.LogPartNum);
+	lambda = geo.Lambda;
 	M = lambda * PartSize;
 
 	// Allocate storage for hints
-	HintID = new uint32_t [M];
-	Parity = new uint64_t [M*B];
-	ExtraPart = new uint16_t [M];
-	ExtraOffset = new uint16_t [M];
-	SelectCutoff = new uint32_t [M];
-	// Pack the bits together
-	IndicatorBit = new uint8_t[(M+7)/8];
+	Hints = arena.alloc<HintMeta>(M);
+	ExtraHi = LogN > 31 ? arena.alloc<uint16_t>(M) : nullptr;
+	Claimed = arena.alloc<atomic<bool>>(M);
+	Parity = arena.alloc<uint64_t>((uint64_t) M*B);
 	LastHintID = 0;
 
 	dummyIdxUsed = 0;			// ever increasing to not repeat, use % 8 to index
+	Perf = nullptr;
 
+	// Memory for making requests to servers and receiving responses from servers
+	Main.reset(newContext());
+}
+
+TwoSVClient::Context *TwoSVClient::newContext() {
+	return new Context(PartNum, PartSize, B, prf.wide());
+}
 
-	// Allocate memory for making requests to servers and receiving responses from servers
-	bvec = new bool [PartNum];
-	Svec = new uint32_t [PartNum];
-	Response_b0 = new uint64_t [B];
-	Response_b1 = new uint64_t [B];
-	tmpEntry = new uint64_t [B];
+void TwoSVClient::enablePrecompute(uint32_t Capacity) {
+	Precompute.reset(new HintCache<PRFPartitionID>(PartNum, Capacity, prf.wide()));
+}
+
+uint64_t TwoSVClient::storageBytes(uint32_t LogN, uint32_t EntryB, Geometry geo) {
+	geo = geo.resolve(LogN);
+	uint64_t M = (uint64_t) geo.Lambda << (LogN - geo.LogPartNum);
+	return M * (sizeof(HintMeta) + (LogN > 31 ? sizeof(uint16_t) : 0) + EntryB);
+}
+
+double TwoSVClient::invalidRate() const {
+	uint32_t invalid = 0;
+	for (uint32_t j = 0; j < M; j++)
+		invalid += !Hints[j].Cutoff;
+	return (double) invalid / M;
 }
 
 void TwoSVClient::Offline(TwoSVServer & offline_server) {
+	METRICS_SCOPED_TIMER(ClientOffline);
+	if (Perf) Perf->begin(PerfCounters::Offline);
 	// Initialize the hint parity array to 0.
 	memset(Parity, 0, sizeof(uint64_t) * B * M);
-	// For offline generation the indicator bit is always set to 1.
-	memset(IndicatorBit, 255, (M+7)/8);
 
-  // Initialize hints.
+  // Initialize hints. The server sets the indicator bit to 1 for offline generation.
 	for (uint64_t j = 0; j < M; j++){
-		HintID[j] = j;
+		Hints[j].ID = j;
 	}
 
-	offline_server.generateOfflineHints(M,Parity,ExtraPart,ExtraOffset, SelectCutoff);
+	offline_server.generateOfflineHints(M, Parity, Hints, ExtraHi);
 	LastHintID = M;
+	if (Precompute)
+		Precompute->clear();
+	if (Perf) Perf->end();
 }
 
-uint16_t TwoSVClient::NextDummyIdx() {
-	if (dummyIdxUsed % 8 == 0)	// need more dummy indices
-		prf.evaluate((uint8_t*) prfDummyIndices, 0, dummyIdxUsed / 8, 0);
-	return prfDummyIndices[dummyIdxUsed++ % 8]; 
+uint32_t TwoSVClient::NextDummyIdx() {
+	uint32_t s = prf.idxShift();
+	uint64_t d = dummyIdxUsed++;
+	uint32_t lane = d & ((1 << s) - 1);
+	if (lane == 0)	// need more dummy indices
+		prf.evaluateDummyIdx(prfDummyIndices, d >> s);
+	return prfDummyIndices[lane]; 
 }
 
-void TwoSVClient::Online(TwoSVServer & online_server, TwoSVServer & offline_server, uint32_t query, uint64_t *result)
+inline bool TwoSVClient::HasQuery(PRFPartitionID &prf, uint64_t i, uint64_t query)
 {
-	assert(query <= N);
-	uint16_t queryPartNum = query / PartSize;
-	uint16_t queryOffset = query & (PartSize-1);
-	uint64_t hintIndex = 0;
-	bool b_indicator = 0;
+	const HintMeta hint = loadHint(Hints + i);
+	if (hint.extraIdx() == (query & 0x7fffffff) && (!ExtraHi || __atomic_load_n(ExtraHi + i, __ATOMIC_RELAXED) == query >> 31))
+		return true;
+	uint32_t queryPartNum = query / PartSize;
+	uint32_t r = prf.PRF4Idx(hint.ID, queryPartNum);	
+	if ((r ^ query) & (PartSize-1))	// Check if r == query mod PartSize
+		return false;
+	bool b = prf.PRF4Select(hint.ID, queryPartNum, hint.Cutoff);	
+	return b == hint.flag();
+}
 
-	// Run Algorithm 2
+uint64_t TwoSVClient::FindHint(PRFPartitionID &prf, uint64_t query, uint64_t start)
+{
+	uint64_t hintIndex = start;
   // Find a hint that has our desired query index
 	for (; hintIndex < M; hintIndex++){
-		b_indicator = (IndicatorBit[hintIndex/8] >> (hintIndex % 8)) & 1;
-		if (ExtraPart[hintIndex] == queryPartNum && ExtraOffset[hintIndex] == queryOffset)
-			break;
-		uint32_t r = prf.PRF4Idx(HintID[hintIndex], queryPartNum);	
-		if ((r ^ query) & (PartSize-1))	// Check if r == query mod PartSize
-			continue;
-		bool b = prf.PRF4Select(HintID[hintIndex], queryPartNum, SelectCutoff[hintIndex]);	
-		if (b == b_indicator)
+		if (HasQuery(prf, hintIndex, query))
 			break;
 	}
-	assert(hintIndex < M);
+	METRICS_ADD(HintSearches, 1);
+	METRICS_ADD(HintsScanned, hintIndex - start + 1);
+	return hintIndex;
+}
 
-	// Build a query. Randomize the selector bit that is sent to the server.
-	uint32_t hintID = HintID[hintIndex];
-	uint16_t prfIndices [8];
-	uint32_t prfSelectVals[4];
-	bool shouldFlip = rand() & 1;
-	uint32_t cutoff = SelectCutoff[hintIndex];
-	for (uint32_t k = 0; k < PartNum; k++)
-	{
-		// Each prf evaluation generates the in-partition offsets for 8 consecutive partitions
-		if (k % 8 == 0){
-			prf.evaluate((uint8_t*)prfIndices, hintID, k / 8, 2);
-		}
-		// Each prf evaluation generates the v values for 4 consecutive partitions
-		if (k % 4 == 0){
-			prf.evaluate((uint8_t *)prfSelectVals, hintID, k / 4, 1);
-		}
+uint64_t TwoSVClient::FindHint(uint64_t query)
+{
+	return FindHint(prf, query, 0);
+}
 
-		if (k == queryPartNum)	// current partition is the partition of interest
-		{
-			bvec[k] = (!b_indicator) ^ shouldFlip;	// dummy
-			Svec[k] = NextDummyIdx() & (PartSize-1);
-			continue; 
+uint64_t TwoSVClient::ClaimHint(PRFPartitionID &prf, uint64_t query)
+{
+	for (;;){
+		bool busy = false; // Some hint that holds query is claimed by another query
+		for (uint64_t i = FindHint(prf, query, 0); i < M; i = FindHint(prf, query, i + 1)){
+			if (Claimed[i].exchange(true, memory_order_acquire)){
+				busy = true;
+				continue;
+			}
+			// Another query may have replenished the hint since the scan read it
+			if (HasQuery(prf, i, query))
+				return i;
+			Claimed[i].store(false, memory_order_release);
 		}
-		else if (ExtraPart[hintIndex] == k) // current partition is the hint's extra partition
-		{
-			bvec[k] = b_indicator ^ shouldFlip;	// real
-			Svec[k] = ExtraOffset[hintIndex];
-			continue;
-		}	
-
-		bool b = prfSelectVals[k % 4] < cutoff;
-		bvec[k] = b ^ shouldFlip;
-		if (b == b_indicator)
-			Svec[k] = prfIndices[k % 8] & (PartSize-1);
-		else
-			Svec[k] = NextDummyIdx() & (PartSize-1);	
+		if (!busy)
+			return M;
+		// The other query releases its hint once it is replenished with an extra entry that is its query, so a rescan finds a hint again
+		this_thread::yield();
 	}
+}
+
+void TwoSVClient::Online(TwoSVServer & online_server, TwoSVServer & offline_server, uint64_t query, uint64_t *result)
+{
+	Main->Perf = Perf;
+	Online(online_server, offline_server, query, result, *Main);
+	LastTimings = Main->Timings;
+}
+
+void TwoSVClient::Online(TwoSVServer & online_server, TwoSVServer & offline_server, uint64_t query, uint64_t *result, Context &ctx)
+{
+	assert(query <= N);
+	auto start = chrono::steady_clock::now();
+	PerfCounters *Perf = ctx.Perf;
+	if (Perf) Perf->begin(PerfCounters::Generate);
+	uint32_t queryPartNum = query / PartSize;
+
+	// Run Algorithm 2
+	uint64_t hintIndex = ClaimHint(ctx.prf, query);
+	assert(hintIndex < M);
+	HintMeta hint = Hints[hintIndex];
+	bool b_indicator = hint.flag();
+
+	// Build a query. Randomize the selector bit that is sent to the server.
+	uint32_t hintID = hint.ID;
+	uint64_t extraIdx = hintExtra(Hints, ExtraHi, hintIndex);
+	bool shouldFlip = rand() & 1;
+	uint32_t cutoff = hint.Cutoff;
+	if (!Precompute || !Precompute->take(hintID, ctx.builder.SelectVals, ctx.builder.Offsets))
+		ctx.builder.expand(ctx.prf, hintID);
+	uint64_t dummyIdx = dummyIdxUsed.fetch_add(ctx.builder.dummySpan(ctx.prf));
+	ctx.builder.drawDummies(ctx.prf, dummyIdx);
+	ctx.builder.build(cutoff, 0, b_indicator, shouldFlip, queryPartNum, extraIdx, ctx.bvec, ctx.Svec);
 
 	// Make our query
+	auto generated = chrono::steady_clock::now();
+	if (Perf) Perf->begin(PerfCounters::Answer);
+	uint64_t *Response_b0 = ctx.Response_b0, *Response_b1 = ctx.Response_b1;
 	memset(Response_b0, 0, sizeof(uint64_t) * B);
 	memset(Response_b1, 0, sizeof(uint64_t) * B);
-	online_server.onlineQuery(bvec, Svec, Response_b0, Response_b1);
+	online_server.onlineQuery(ctx.bvec, ctx.Svec, Response_b0, Response_b1);
 	
 	// Set the query result to the correct response.
 	uint64_t * QueryResult = Response_b1;
@@ -135,11 +186,16 @@ void TwoSVClient::Online(TwoSVServer & online_server, TwoSVServer & offline_serv
 		QueryResult = Response_b0;
 	} 
 	for (uint32_t l = 0; l < B; l++)
-		result[l] = QueryResult[l] ^ Parity[hintIndex*B + l]; 
+		result[l] = QueryResult[l] ^ Parity[(uint64_t) hintIndex*B + l]; 
 
 
 	#ifdef DEBUG
 	// Check actual value 
+	uint32_t extraPart = extraIdx / PartSize;
+	bool *bvec = ctx.bvec;
+	uint32_t *Svec = ctx.Svec;
+	uint64_t *tmpEntry = ctx.tmpEntry;
+	PRFPartitionID &prf = ctx.prf;
 	online_server.getEntryFromServer(query, tmpEntry);
 
 	for (uint32_t l = 0; l < B; l++){
@@ -147,16 +203,16 @@ void TwoSVClient::Online(TwoSVServer & online_server, TwoSVServer & offline_serv
 			cout << "Query failed, debugging query " << query << endl;
 			assert(query < N);
 			cout << "Computed result: " << result[l] << "\n" << "Actual entry value: " << tmpEntry[l] << endl;
-			cout << "Parity sent by server: " << QueryResult[l] << "\nHint parity: " << Parity[hintIndex*B + l] << endl;
+			cout << "Parity sent by server: " << QueryResult[l] << "\nHint parity: " << Parity[(uint64_t) hintIndex*B + l] << endl;
 			for (uint32_t k = 0; k < PartNum; k++)
 			{
-				if (query / PartSize != k && ExtraPart[hintIndex] != k)
+				if (query / PartSize != k && extraPart != k)
 				{
 					assert(prf.PRF4Select(hintID, k, cutoff) == bvec[k] ^ shouldFlip);
 					assert(!(bvec[k] ^ shouldFlip) || prf.PRF4Idx(hintID, k) % PartSize == Svec[k]);
 				}
 			}
-			cout << "Extra entry partition num: " << ExtraPart[hintIndex] << "\nExtra entry offset: " << ExtraOffset[hintIndex] << endl;
+			cout << "Extra entry partition num: " << extraPart << "\nExtra entry offset: " << (extraIdx & (PartSize-1)) << endl;
 			assert(0);
 		}
 	}
@@ -164,60 +220,97 @@ void TwoSVClient::Online(TwoSVServer & online_server, TwoSVServer & offline_serv
 
 	// Run client side part of Algorithm 3.
   // Replenish hint. Parity indicator represents the bit that we will use for our hint.
-	uint64_t hint_parities[2*B];
-	++LastHintID;
-	offline_server.replenishHint(LastHintID, hint_parities, SelectCutoff + hintIndex);
-
-	b_indicator = !(prf.PRF4Select(LastHintID, queryPartNum, SelectCutoff[hintIndex]));
-	IndicatorBit[hintIndex/8] = (IndicatorBit[hintIndex/8] & ~(1<<(hintIndex%8))) | b_indicator << (hintIndex % 8);
-	HintID[hintIndex] = LastHintID;
-	ExtraPart[hintIndex] = queryPartNum;
-	ExtraOffset[hintIndex] = queryOffset; 
+	auto answered = chrono::steady_clock::now();
+	if (Perf) Perf->begin(PerfCounters::Replenish);
+	uint64_t newHintID = ++LastHintID;
+	offline_server.replenishHint(newHintID, ctx.hintParities, &hint.Cutoff);
+
+	b_indicator = !(ctx.prf.PRF4Select(newHintID, queryPartNum, hint.Cutoff));
+	hint.ID = newHintID;
+	hint.setExtra(query & 0x7fffffff, b_indicator);
+	storeHint(Hints + hintIndex, hint);
+	if (ExtraHi)
+		__atomic_store_n(ExtraHi + hintIndex, query >> 31, __ATOMIC_RELAXED);
 	for (uint32_t l = 0; l < B; l++){
-		Parity[hintIndex*B+l] = hint_parities[b_indicator*B+l] ^ result[l];
+		Parity[(uint64_t) hintIndex*B+l] = ctx.hintParities[b_indicator*B+l] ^ result[l];
 	}
+	Claimed[hintIndex].store(false, memory_order_release);
+	if (Precompute)
+		Precompute->prefetch(hint.ID);
+	if (Perf) Perf->end();
+	auto end = chrono::steady_clock::now();
+	ctx.Timings.Generate = chrono::duration_cast<chrono::nanoseconds>(generated - start).count();
+	ctx.Timings.Answer = chrono::duration_cast<chrono::nanoseconds>(answered - generated).count();
+	ctx.Timings.Replenish = chrono::duration_cast<chrono::nanoseconds>(end - answered).count();
+	METRICS_TIME(ClientGenerate, ctx.Timings.Generate);
+	METRICS_TIME(ClientAnswer, ctx.Timings.Answer);
+	METRICS_TIME(ClientReplenish, ctx.Timings.Replenish);
 }
 
-OneSVClient::OneSVClient(uint32_t LogN, uint32_t EntryB):
+OneSVClient::OneSVClient(uint32_t LogN, uint32_t EntryB, Geometry geo):
 	prf(AES_KEY)
 {
-	assert(LogN < 32);
+	assert(LogN <= MAX_LOG_N);
 	assert(EntryB >= 8);
-	N = 1 << LogN;
+	N = (uint64_t) 1 << LogN;
+	geo = geo.resolve(LogN);
+	prf.setWide(geo.Wide);
 	B = EntryB / 8;
 	EntrySize = EntryB;
 
-	PartNum = 1 << (LogN / 2);
-	PartSize = 1 << (LogN / 2 + LogN % 2);
-	lambda = LAMBDA;
+	PartNum = 1u << geo.LogPartNum;
+	PartSize = 1u << (LogN - geo.LogPartNum);
+	lambda = geo.Lambda;
 	M = lambda * PartSize;
 
 	// Allocate storage for hints
-	HintID = new uint32_t [M];
-	SelectCutoff = new uint32_t [M*2];	
-	Parity = new uint64_t [M*2*B];
-	ExtraPart = new uint16_t [M];
-	ExtraOffset = new uint16_t [M];
-	FlipCutoff = new bool [M];	
-
-	prfSelectVals = new uint32_t [PartNum*4];	// temporary for offline online
-	DBPart = new uint64_t [PartSize * B]; // streamed partition
+	Hints = arena.alloc<HintMeta>(M);
+	ExtraHi = LogN > 31 ? arena.alloc<uint16_t>(M) : nullptr;
+	Claimed = arena.alloc<atomic<bool>>(M);
+	BackupCutoff = arena.alloc<uint32_t>(M/2);
+	Parity = arena.alloc<uint64_t>((uint64_t) M*2*B);
+
+	prfSelectVals = arena.alloc<uint32_t>(PartNum*4);	// temporary for offline online
+	DBPart = arena.alloc<uint64_t>((uint64_t) PartSize * B); // streamed partition
 	dummyIdxUsed = 0;			// ever increasing to not repeat, use % 8 to index
+	Perf = nullptr;
 
 	// request to server and response from server
-	bvec = new bool [PartNum];
-	Svec = new uint32_t [PartNum];
-	Response_b0 = new uint64_t [B];
-	Response_b1 = new uint64_t [B];
-	tmpEntry = new uint64_t [B];
+	Main.reset(newContext());
 }
 
+OneSVClient::Context *OneSVClient::newContext() {
+	return new Context(PartNum, PartSize, B, prf.wide());
+}
+
+void OneSVClient::enablePrecompute(uint32_t Capacity) {
+	Precompute.reset(new HintCache<PRFHintID>(PartNum, Capacity, prf.wide()));
+}
+
+
+uint64_t OneSVClient::storageBytes(uint32_t LogN, uint32_t EntryB, Geometry geo) {
+	geo = geo.resolve(LogN);
+	uint64_t PartSize = (uint64_t) 1 << (LogN - geo.LogPartNum);
+	uint64_t M = geo.Lambda * PartSize;
+	// Hints and their parities, then M/2 backup cutoffs and M/2 pairs of backup parities
+	return M * (sizeof(HintMeta) + (LogN > 31 ? sizeof(uint16_t) : 0) + EntryB) + M/2 * (sizeof(uint32_t) + 2 * EntryB) + (uint64_t) PartSize * EntryB;
+}
+
+double OneSVClient::invalidRate() const {
+	uint32_t invalid = 0;
+	for (uint32_t j = 0; j < M; j++)
+		invalid += !Hints[j].Cutoff;
+	return (double) invalid / M;
+}
 
 void OneSVClient::Offline(OneSVServer &server) {
+	METRICS_SCOPED_TIMER(ClientOffline);
+	if (Perf) Perf->begin(PerfCounters::Offline);
 	Q = 0;
 	BackupUsedAgain = 0;
+	if (Precompute)
+		Precompute->clear();
 	memset(Parity, 0, sizeof(uint64_t) * B * M * 2);
-	memset(FlipCutoff, 0, sizeof(bool)*M);
 	
 	uint32_t InvalidHints = 0;
 	uint32_t prfOut [4]; 
@@ -232,140 +325,202 @@ void OneSVClient::Offline(OneSVServer &server) {
 					prfSelectVals[PartNum*l+ k] = prfOut[l];
 			}
 		}
-		SelectCutoff[j] = FindCutoff(prfSelectVals + PartNum*(j%4), PartNum);
-		InvalidHints += !SelectCutoff[j];	
+		uint32_t cutoff = FindCutoff(prfSelectVals + PartNum*(j%4), PartNum);
+		if (j < M)
+			Hints[j].Cutoff = cutoff;
+		else
+			BackupCutoff[j - M] = cutoff;
+		InvalidHints += !cutoff;	
 	}
+	METRICS_ADD(InvalidHints, InvalidHints);
+	METRICS_SET(BackupHintsLeft, M/2);
 	cout << "Offline: cutoffs done, invalid hints: " << InvalidHints << endl;
 
-	uint16_t prfIndices [8];
 	for (uint32_t j = 0; j < M; j++)
 	{
-		HintID[j] = j;
+		Hints[j].ID = j;
 
-		uint16_t ePart;
+		uint32_t ePart;
 		bool b = 1;
 		while (b)	// keep picking until hitting an un-selected partition
 		{
 			ePart = NextDummyIdx() % PartNum; 
-			b = prf.PRF4Select(j, ePart, SelectCutoff[j]);	
+			b = prf.PRF4Select(j, ePart, Hints[j].Cutoff);	
 		}
-		uint16_t eIdx = NextDummyIdx() % PartSize;
-		ExtraPart[j] = ePart;
-		ExtraOffset[j] = eIdx;
+		uint32_t eIdx = NextDummyIdx() % PartSize;
+		setHintExtra(Hints, ExtraHi, j, (uint64_t) ePart*PartSize + eIdx, 0);
 	}
 	cout << "Offline: extra indices done." << endl;
 
   // Run Algorithm 4
   // Simulates streaming the entire database one partition at a time.
-	uint64_t *DBPart = new uint64_t [PartSize * B]; 
 	for (uint32_t k = 0; k < PartNum; k++)
 	{
 		for (uint32_t i = 0; i < PartSize; i++)
-			server.getEntry(k*PartSize + i, DBPart + i * B);
-	
-		for (uint32_t j = 0; j < M + M/2; j++)
+			server.getEntry((uint64_t) k*PartSize + i, DBPart + (uint64_t) i * B);
+		ProcessPartition(k);
+	}
+	// Concurrent queries claim dummy indices in whole PRF blocks
+	dummyIdxUsed = (dummyIdxUsed + 7) / 8 * 8;
+	if (Perf) Perf->end();
+}
+
+void OneSVClient::ProcessPartition(uint32_t k)
+{
+	uint32_t prfOut [4]; 
+	uint32_t prfIndices [8];
+	uint32_t s = prf.idxShift();
+	uint32_t lane = (1 << s) - 1;
+	for (uint32_t j = 0; j < M + M/2; j++)
+	{
+		if ((j % 4) == 0)
+			prf.evaluate((uint8_t*) prfOut, j / 4, k, 1);
+		if ((j & lane) == 0)
+			prf.evaluateIdx(prfIndices, j >> s, k, 2);
+		uint32_t r = prfIndices[j & lane] & (PartSize-1);	// faster than mod 
+			
+		if (j < M)
 		{
-			if ((j % 4) == 0)
-				prf.evaluate((uint8_t*) prfOut, j / 4, k, 1);
-			if ((j % 8) == 0)
-				prf.evaluate((uint8_t*) prfIndices, j / 8, k, 2);
-			bool b = prfOut[j % 4] < SelectCutoff[j];
-			uint16_t r = prfIndices[j % 8] & (PartSize-1);	// faster than mod 
-				
-			if (j < M)
-			{
-				if (b)
-					for (uint32_t l = 0; l < B; l++)
-						Parity[j*B+l] ^= DBPart[r*B+l];
-				else if (ExtraPart[j] == k) 
-					for (uint32_t l = 0; l < B; l++)
-						Parity[j*B+l] ^= DBPart[ExtraOffset[j] * B + l];
-			}
-			else			// construct backup hints in pairs
-			{
-				uint32_t dst = j * B + (!b) * B * M/2;
+			bool b = prfOut[j % 4] < Hints[j].Cutoff;
+			uint64_t e = hintExtra(Hints, ExtraHi, j) - (uint64_t) k * PartSize;	// offset of the extra entry if it is in partition k
+			if (b)
 				for (uint32_t l = 0; l < B; l++)
-					Parity[dst+l] ^= DBPart[r*B+l];
-			}
+					Parity[(uint64_t) j*B+l] ^= DBPart[(uint64_t) r*B+l];
+			else if (e < PartSize) 
+				for (uint32_t l = 0; l < B; l++)
+					Parity[(uint64_t) j*B+l] ^= DBPart[e * B + l];
+		}
+		else			// construct backup hints in pairs
+		{
+			bool b = prfOut[j % 4] < BackupCutoff[j - M];
+			uint64_t dst = (uint64_t) j * B + (uint64_t) (!b) * B * M/2;
+			for (uint32_t l = 0; l < B; l++)
+				Parity[dst+l] ^= DBPart[(uint64_t) r*B+l];
 		}
 	}
 }
 	
 
 
-uint16_t OneSVClient::NextDummyIdx()
+uint32_t OneSVClient::NextDummyIdx()
 {
-	if (dummyIdxUsed % 8 == 0)	// need more dummy indices
-		prf.evaluate((uint8_t*) prfDummyIndices, 0, dummyIdxUsed / 8, 0);
-	return prfDummyIndices[dummyIdxUsed++ % 8]; 
+	uint32_t s = prf.idxShift();
+	uint64_t d = dummyIdxUsed++;
+	uint32_t lane = d & ((1 << s) - 1);
+	if (lane == 0)	// need more dummy indices
+		prf.evaluateDummyIdx(prfDummyIndices, d >> s);
+	return prfDummyIndices[lane]; 
 }
 
-void OneSVClient::Online(OneSVServer &server, uint32_t query, uint64_t *result)
+inline bool OneSVClient::HasQuery(PRFHintID &prf, uint32_t i, uint64_t query)
 {
-	if (query >= N)	query -= N;
-	uint16_t queryPartNum = query / PartSize;
-	uint16_t queryOffset = query & (PartSize-1);
-	uint32_t hintIndex = 0;
-	
-	// Run Algorithm 2
-	// Find a hint that has our desired q
-	// checking ej first won't improveuery index
+	const HintMeta hint = loadHint(Hints + i);
+	if (hint.Cutoff == 0) // Invalid hint
+		return false;
+	if (hint.extraIdx() == (query & 0x7fffffff) && (!ExtraHi || __atomic_load_n(ExtraHi + i, __ATOMIC_RELAXED) == query >> 31)) // Query is the extra entry that the hint stores
+		return true;
+	uint32_t queryPartNum = query / PartSize;
+	uint32_t r = prf.PRF4Idx(hint.ID, queryPartNum);	
+	if ((r ^ query) & (PartSize-1))	// Check if r == query mod PartSize
+		return false;
+	return prf.PRF4Select(hint.ID, queryPartNum, hint.Cutoff, hint.flag());	
+}
+
+uint32_t OneSVClient::FindHint(PRFHintID &prf, uint64_t query, uint32_t start)
+{
+	uint32_t hintIndex = start;
+	// Find a hint that has our desired query index
+	// checking ej first won't improve
 	for (; hintIndex < M; hintIndex++)		 {
-		if (SelectCutoff[hintIndex] == 0) // Invalid hint
-			continue;
-		if (ExtraPart[hintIndex] == queryPartNum && ExtraOffset[hintIndex] == queryOffset) // Query is the extra entry that the hint stores
-			break;
-		uint32_t r = prf.PRF4Idx(HintID[hintIndex], queryPartNum);	
-		if ((r ^ query) & (PartSize-1))	// Check if r == query mod PartSize
-			continue;
-		bool b = prf.PRF4Select(HintID[hintIndex], queryPartNum, SelectCutoff[hintIndex], FlipCutoff[hintIndex]);	
-		if (b)
+		if (HasQuery(prf, hintIndex, query))
 			break;
 	}
+	METRICS_ADD(HintSearches, 1);
+	METRICS_ADD(HintsScanned, hintIndex - start + 1);
+	return hintIndex;
+}
+
+uint32_t OneSVClient::FindHint(uint64_t query)
+{
+	return FindHint(prf, query, 0);
+}
+
+uint32_t OneSVClient::ClaimHint(PRFHintID &prf, uint64_t query)
+{
+	for (;;){
+		bool busy = false; // Some hint that holds query is claimed by another query
+		for (uint32_t i = FindHint(prf, query, 0); i < M; i = FindHint(prf, query, i + 1)){
+			if (Claimed[i].exchange(true, memory_order_acquire)){
+				busy = true;
+				continue;
+			}
+			// Another query may have replenished the hint since the scan read it
+			if (HasQuery(prf, i, query))
+				return i;
+			Claimed[i].store(false, memory_order_release);
+		}
+		if (!busy)
+			return M;
+		// The other query releases its hint once it is replenished with an extra entry that is its query, so a rescan finds a hint again
+		this_thread::yield();
+	}
+}
+
+void OneSVClient::Online(OneSVServer &server, uint64_t query, uint64_t *result)
+{
+	Main->Perf = Perf;
+	Online(server, query, result, *Main);
+	LastTimings = Main->Timings;
+}
+
+void OneSVClient::Online(OneSVServer &server, uint64_t query, uint64_t *result, Context &ctx)
+{
+	if (query >= N)	query -= N;
+	auto start = chrono::steady_clock::now();
+	PerfCounters *Perf = ctx.Perf;
+	if (Perf) Perf->begin(PerfCounters::Generate);
+	uint32_t queryPartNum = query / PartSize;
+	
+	// Run Algorithm 2
+	uint32_t hintIndex = ClaimHint(ctx.prf, query);
 	assert(hintIndex < M);
 
 	// Build a query. Randomize the selector bit that is sent to the server.
-	uint32_t hintID = HintID[hintIndex];
+	HintMeta hint = Hints[hintIndex];
+	uint32_t hintID = hint.ID;
+	uint32_t cutoff = hint.Cutoff;
+	bool flip = hint.flag();
+	uint64_t extraIdx = hintExtra(Hints, ExtraHi, hintIndex);
 	bool shouldFlip = rand() & 1;
-	if (hintID > M)
+	if (hintID >= M){
 		BackupUsedAgain++;
-
-	for (uint32_t k = 0; k < PartNum; k++)
-	{
-		if (k == queryPartNum)	// partition of interest
-		{
-			bvec[k] = 0 ^ shouldFlip;	// dummy
-			Svec[k] = NextDummyIdx() & (PartSize-1);
-			continue; 
-		}
-		else if (ExtraPart[hintIndex] == k)
-		{
-			bvec[k] = 1 ^ shouldFlip;	// real
-			Svec[k] = ExtraOffset[hintIndex];
-			continue;
-		}	
-
-		bool b = prf.PRF4Select(hintID, k, SelectCutoff[hintIndex], FlipCutoff[hintIndex]);
-		bvec[k] =  b ^ shouldFlip;
-		if (b)
-			Svec[k] = prf.PRF4Idx(hintID, k) & (PartSize-1);
-		else
-			Svec[k] = NextDummyIdx() & (PartSize-1);	
+		METRICS_ADD(BackupUsedAgain, 1);
 	}
 
+	if (!Precompute || !Precompute->take(hintID, ctx.builder.SelectVals, ctx.builder.Offsets))
+		ctx.builder.expand(ctx.prf, hintID);
+	uint64_t dummyIdx = dummyIdxUsed.fetch_add(ctx.builder.dummySpan(ctx.prf));
+	ctx.builder.drawDummies(ctx.prf, dummyIdx);
+	ctx.builder.build(cutoff, flip, 1, shouldFlip, queryPartNum, extraIdx, ctx.bvec, ctx.Svec);
+
  // Make our query
+	auto generated = chrono::steady_clock::now();
+	if (Perf) Perf->begin(PerfCounters::Answer);
+	uint64_t *Response_b0 = ctx.Response_b0, *Response_b1 = ctx.Response_b1;
 	memset(Response_b0, 0, sizeof(uint64_t) * B);
 	memset(Response_b1, 0, sizeof(uint64_t) * B);
-	server.onlineQuery(bvec, Svec, Response_b0, Response_b1);
+	server.onlineQuery(ctx.bvec, ctx.Svec, Response_b0, Response_b1);
 
 	uint64_t * QueryResult = shouldFlip ? Response_b0 : Response_b1;
 	 
 	for (uint32_t l = 0; l < B; l++)
-		result[l] = QueryResult[l] ^ Parity[hintIndex*B + l]; 
+		result[l] = QueryResult[l] ^ Parity[(uint64_t) hintIndex*B + l]; 
 
 
 #ifdef DEBUG
 	// Check for correctness 
+	uint32_t extraPart = extraIdx / PartSize;
+	uint64_t *tmpEntry = ctx.tmpEntry;
 	server.getEntry(query, tmpEntry);
 
 	for (uint32_t l = 0; l < B; l++){
@@ -373,27 +528,45 @@ void OneSVClient::Online(OneSVServer &server, uint32_t query, uint64_t *result)
 			cout << "Query failed, debugging query " << query << endl;
 			assert(query < N);
 			cout << "Computed result: " << result[l] << "\n" << "Actual entry value: " << tmpEntry[l] << endl;
-			cout << "Parity sent by server: " << QueryResult[l] << "\nHint parity: " << Parity[hintIndex*B + l] << endl;
-			cout << "Extra entry partition num: " << ExtraPart[hintIndex] << "\nExtra entry offset: " << ExtraOffset[hintIndex] << endl;
+			cout << "Parity sent by server: " << QueryResult[l] << "\nHint parity: " << Parity[(uint64_t) hintIndex*B + l] << endl;
+			cout << "Extra entry partition num: " << extraPart << "\nExtra entry offset: " << (extraIdx & (PartSize-1)) << endl;
 
 			assert(0);
 		}
 	}
 #endif
 
-	while (SelectCutoff[M+Q] == 0)	// skip invalid hints
-		Q++;
+	auto answered = chrono::steady_clock::now();
+	if (Perf) Perf->begin(PerfCounters::Replenish);
+	uint32_t q = Q++;
+	while (q < M/2 && BackupCutoff[q] == 0){	// skip invalid hints
+		q = Q++;
+		METRICS_ADD(BackupHintsSkipped, 1);
+	}
+	assert(q < M/2);
 
   // Run Algorithm 5
   // Replenish a hint using a backup hint.
-	HintID[hintIndex] = M + Q;
-	SelectCutoff[hintIndex] = SelectCutoff[M+Q];
-	ExtraPart[hintIndex] = queryPartNum;
-	ExtraOffset[hintIndex] = queryOffset; 
-	FlipCutoff[hintIndex] = prf.PRF4Select(M + Q, queryPartNum, SelectCutoff[M+Q]);		
-	uint32_t src = M*B + Q*B + FlipCutoff[hintIndex] * B * M/2;
+	bool newFlip = ctx.prf.PRF4Select(M + q, queryPartNum, BackupCutoff[q]);		
+	hint.ID = M + q;
+	hint.Cutoff = BackupCutoff[q];
+	hint.setExtra(query & 0x7fffffff, newFlip);
+	uint64_t src = (uint64_t) M*B + (uint64_t) q*B + (uint64_t) newFlip * B * M/2;
 	for (uint32_t l = 0; l < B; l++)
-		Parity[hintIndex*B+l] = Parity[src+l] ^ result[l];
-	Q++;
-	assert(Q < M/2);
-}
\ No newline at end of file
+		Parity[(uint64_t) hintIndex*B+l] = Parity[src+l] ^ result[l];
+	storeHint(Hints + hintIndex, hint);
+	if (ExtraHi)
+		__atomic_store_n(ExtraHi + hintIndex, query >> 31, __ATOMIC_RELAXED);
+	Claimed[hintIndex].store(false, memory_order_release);
+	if (Precompute)
+		Precompute->prefetch(hint.ID);
+	METRICS_SET(BackupHintsLeft, M/2 - q - 1);
+	if (Perf) Perf->end();
+	auto end = chrono::steady_clock::now();
+	ctx.Timings.Generate = chrono::duration_cast<chrono::nanoseconds>(generated - start).count();
+	ctx.Timings.Answer = chrono::duration_cast<chrono::nanoseconds>(answered - generated).count();
+	ctx.Timings.Replenish = chrono::duration_cast<chrono::nanoseconds>(end - answered).count();
+	METRICS_TIME(ClientGenerate, ctx.Timings.Generate);
+	METRICS_TIME(ClientAnswer, ctx.Timings.Answer);
+	METRICS_TIME(ClientReplenish, ctx.Timings.Replenish);
+}
@@ -0,0 +1,81 @@
+#include <pthread.h>
+#include <sched.h>
+#include <thread>
+
+#include "dbgen.h"
+
+// Generates the keystream of bytes [Begin, End), which must be 8 byte aligned, into out.
+static void keystream(ECB_Mode< AES >::Encryption &enc, uint64_t *out, uint64_t Begin, uint64_t End)
+{
+	const uint64_t BatchBlocks = 1024; // Counters are encrypted in batches so AES can pipeline blocks
+	uint64_t ctr[2 * BatchBlocks];
+	uint64_t block = Begin / 16;
+	uint64_t lastBlock = (End + 15) / 16;
+	uint64_t skip = (Begin % 16) / 8; // Words of the first block that precede Begin
+	uint64_t words = (End - Begin) / 8;
+	while (block < lastBlock){
+		uint64_t n = min(BatchBlocks, lastBlock - block);
+		for (uint64_t b = 0; b < n; b++){
+			ctr[2 * b] = block + b;
+			ctr[2 * b + 1] = 0;
+		}
+		enc.ProcessData((uint8_t*) ctr, (uint8_t*) ctr, n * 16);
+		uint64_t copy = min(words, 2 * n - skip);
+		memcpy(out, ctr + skip, copy * 8);
+		out += copy;
+		words -= copy;
+		skip = 0;
+		block += n;
+	}
+}
+
+DBGenerator::DBGenerator(uint32_t EntryB, uint64_t Seed) : EntrySize(EntryB), Seed(Seed) {
+	assert(EntryB >= 8 && EntryB % 8 == 0);
+	Key[0] = Seed;
+	Key[1] = 0x3142445249503353ull; // "S3PIRDB1"
+	enc_.SetKey((const CryptoPP::byte*) Key, AES::DEFAULT_KEYLENGTH);
+}
+
+void DBGenerator::fillRange(uint64_t *out, uint64_t First, uint64_t Count) {
+	keystream(enc_, out, First * EntrySize, (First + Count) * EntrySize);
+}
+
+void DBGenerator::fill(uint64_t *DB, uint64_t NumEntries, uint32_t Threads) {
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	sched_getaffinity(0, sizeof(allowed), &allowed);
+	vector<int> cpus;
+	for (int c = 0; c < CPU_SETSIZE; c++)
+		if (CPU_ISSET(c, &allowed))
+			cpus.push_back(c);
+	if (Threads == 0)
+		Threads = max((size_t) 1, cpus.size());
+	// Small databases are not worth the threads
+	Threads = (uint32_t) min((uint64_t) Threads, max((uint64_t) 1, NumEntries * EntrySize >> 22));
+
+	uint64_t B = EntrySize / 8;
+	uint64_t Slice = (NumEntries + Threads - 1) / Threads;
+	vector<thread> workers;
+	for (uint32_t t = 0; t < Threads; t++){
+		uint64_t first = min(NumEntries, t * Slice);
+		uint64_t count = min(NumEntries - first, Slice);
+		int cpu = cpus.empty() ? -1 : cpus[t % cpus.size()];
+		workers.push_back(thread([this, DB, B, first, count, cpu](){
+			if (cpu >= 0){
+				cpu_set_t set;
+				CPU_ZERO(&set);
+				CPU_SET(cpu, &set);
+				pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+			}
+			ECB_Mode< AES >::Encryption enc;
+			enc.SetKey((const CryptoPP::byte*) Key, AES::DEFAULT_KEYLENGTH);
+			keystream(enc, DB + first * B, first * EntrySize, (first + count) * EntrySize);
+		}));
+	}
+	for (auto &w : workers)
+		w.join();
+}
+
+void DBGenerator::entry(uint64_t index, uint64_t *result) {
+	keystream(enc_, result, index * EntrySize, (index + 1) * EntrySize);
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+using namespace std;
+
+/*
+Owns every buffer allocated by a client or server instance and frees them together when the instance is destroyed.
+Small requests are bump-allocated out of shared blocks, large ones get their own block. Every pointer is 64-byte aligned.
+Blocks are mmapped and zeroed by the allocating thread, so first-touch places their pages on the local NUMA node. 
+Blocks of at least 2 MB are additionally backed by transparent huge pages where available.
+*/
+class Arena {
+  public:
+  Arena() : cur(nullptr), curLeft(0) {}
+  ~Arena();
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  // Returns a zeroed array of count T's, aligned to align bytes (a power of two, at least 64).
+  template<typename T>
+  T *alloc(size_t count, size_t align = 64) {
+    return (T*) allocBytes(count * sizeof(T), align);
+  }
+
+  size_t bytesReserved() const; // Total size of all blocks
+
+  private:
+  struct Block {
+    uint8_t *base;
+    size_t size;
+  };
+  void *allocBytes(size_t size, size_t align);
+  Block newBlock(size_t size);
+
+  vector<Block> blocks;
+  uint8_t *cur; // Free space of the current shared block
+  size_t curLeft;
+};
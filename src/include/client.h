@@ -1,62 +1,128 @@
 #pragma once
+#include <atomic>
 #include <cstdint>
+#include <memory>
 #include "cryptopp/modes.h"
 #include "cryptopp/osrng.h"
 
 #include "server.h"
 #include "utils.h"
+#include "arena.h"
+#include "query.h"
+#include "perfcounters.h"
 
 typedef unsigned __int128 uint128_t;
 
+// Time spent in each stage of an Online call, in nanoseconds.
+struct QueryTimings {
+	uint64_t Generate; // Finding a hint and building the query
+	uint64_t Answer; // Server answering the query and decoding the result
+	uint64_t Replenish; // Replenishing the used hint
+};
+
+/*
+Scratch space of one query in flight. Online calls that run at the same time must each pass their own context, created with the client's newContext.
+Every context evaluates its own PRF since CryptoPP ciphers are not thread-safe.
+*/
+template<typename PRF>
+struct QueryContext {
+	QueryContext(uint32_t PartNum, uint32_t PartSize, uint32_t B, bool wide) : prf(AES_KEY), Perf(nullptr) {
+		prf.setWide(wide);
+		bvec = arena.alloc<bool>(PartNum);
+		Svec = arena.alloc<uint32_t>(PartNum);
+		Response_b0 = arena.alloc<uint64_t>(B);
+		Response_b1 = arena.alloc<uint64_t>(B);
+		tmpEntry = arena.alloc<uint64_t>(B);
+		hintParities = arena.alloc<uint64_t>(2*B);
+		builder.init(arena, PartNum, PartSize);
+	}
+
+	Arena arena; // Owns every array below
+	PRF prf;
+	QueryBuilder builder;
+	bool *bvec;			// Select bits to send to server. 0 selects that index to be included in parity b0. 1 selects that index to be included in parity b1. 
+	uint32_t *Svec; 	// Indices sent to server
+	uint64_t *Response_b0; // Parity of entries with select bit = 0 received from the server
+	uint64_t *Response_b1; // Parity of entries with select bit = 1 received from the server
+	uint64_t *tmpEntry; // simulating a fake server 
+	uint64_t *hintParities; // Both parities of a replenished hint received from the offline server (two server variant)
+	QueryTimings Timings; // Stage timings of the last query
+	PerfCounters *Perf; // If set, hardware counters are attributed to the stages of the queries of this context
+};
+
 // Client class for the one server variant.
 class OneSVClient
 {
 public:
   //  LogN: Size of the database given in log10.
   // EntryB: Number of bits in a single entry. 
-	OneSVClient(uint32_t LogN, uint32_t EntryB); 
+  // geo: partitioning and lambda, see Geometry. Must match the server.
+	OneSVClient(uint32_t LogN, uint32_t EntryB, Geometry geo = Geometry()); 
+	// Bytes the client stores for hints, backup hints and the streamed partition.
+	static uint64_t storageBytes(uint32_t LogN, uint32_t EntryB, Geometry geo = Geometry());
+	// Fraction of the hints that FindCutoff found no cutoff for. These hints never hold a query.
+	double invalidRate() const;
 
 	// Runs the offline phase. Simulates streaming the entire DB one partition at a time.
 	void Offline(OneSVServer &server);
 
 	// Runs the online phase with a single query. 
-	void Online(OneSVServer &server, uint32_t query, uint64_t *result);
+	void Online(OneSVServer &server, uint64_t query, uint64_t *result);
+	QueryTimings LastTimings; // Stage timings of the last Online call
+	PerfCounters *Perf; // If set, hardware counters are attributed to the offline phase and the stages of Online
+
+	// Online queries with their own context may run concurrently, each with a server instance of its own.
+	// Two queries never use the same hint: a hint is claimed when it is found and released once it is replenished.
+	typedef QueryContext<PRFHintID> Context;
+	Context *newContext(); // The caller owns the context
+	void Online(OneSVServer &server, uint64_t query, uint64_t *result, Context &ctx);
+
+	// Starts a background thread that expands the rows of the last Capacity replenished hints while the CPU is idle, see HintCache.
+	void enablePrecompute(uint32_t Capacity);
+	unique_ptr<HintCache<PRFHintID>> Precompute; // nullptr unless enablePrecompute was called
+
+	// The steps below are public so that they can be benchmarked on their own.
+	// Returns the index of a hint that contains query, or M if there is none. 
+	uint32_t FindHint(uint64_t query);
+	// Updates every hint and backup hint with partition k, which must already be streamed into DBPart.
+	void ProcessPartition(uint32_t k);
 
 private:
-
-	uint16_t NextDummyIdx();
-	uint16_t prfDummyIndices [8]; // Stores dummy indices to send to server
-	uint64_t dummyIdxUsed;
-
-	uint32_t N; // Number of database entires
+	// Returns whether hint i holds query, as its extra entry or as the entry of a selected partition.
+	bool HasQuery(PRFHintID &prf, uint32_t i, uint64_t query);
+	// Returns the first hint from start on that holds query, or M.
+	uint32_t FindHint(PRFHintID &prf, uint64_t query, uint32_t start);
+	// Finds and claims a hint that holds query, waiting while every such hint is claimed by another query. Returns M if no hint holds query.
+	uint32_t ClaimHint(PRFHintID &prf, uint64_t query);
+
+	uint32_t NextDummyIdx();
+	uint32_t prfDummyIndices [8]; // Stores dummy indices to send to server
+	atomic<uint64_t> dummyIdxUsed;
+
+	uint64_t N; // Number of database entires
 	uint32_t B; // Size of one entry is B * 8 bytes
-	uint32_t Q;	// Number of queries made since offline phase
-	uint32_t BackupUsedAgain;
+	atomic<uint32_t> Q;	// Number of backup hints taken since offline phase
+	atomic<uint32_t> BackupUsedAgain;
 	uint32_t EntrySize; 
 	
-	uint32_t PartNum; // Number of partitions = sqrt(N)
+	uint32_t PartNum; // Number of partitions, sqrt(N) by default
 	uint32_t PartSize; // Number of entries in one partition
 	uint32_t lambda; // Correctness parameter
 	uint32_t M; // Number of hints
 
-	// Hints are stored as arrays. Each hint consists of a HintID, a parity, an extra partition + offset, and a cutoff for the PRF value.
-	uint32_t *HintID;	// Array of hintIDs for each hint.
-	uint32_t *SelectCutoff;	// Array storing the PRF cutoff value for each hint.
-	uint64_t *Parity; // Array of parities for each hint.
-	uint16_t *ExtraPart; // Array storing the extra partition for each hint
-	uint16_t *ExtraOffset; // Array storing the extra offset for each hint.
-	bool *FlipCutoff; // Array storing the indicator bit for each hint. 
+	// Each hint consists of a HintID, a cutoff for the PRF value, an extra entry, a flip bit, and a parity. 
+	// The metadata is packed into one HintMeta record per hint. Parities are kept in a separate array since the online scan does not read them.
+	HintMeta *Hints; // Metadata of the M hints. The flag bit flips the cutoff comparison.
+	uint16_t *ExtraHi; // Bits 31 and up of the extra entry of each hint, nullptr unless N > 2^31
+	atomic<bool> *Claimed; // Set while a query is using the hint
+	uint32_t *BackupCutoff; // PRF cutoff value for each of the M/2 backup hints.
+	uint64_t *Parity; // Array of parities for each hint, followed by the two parities of each backup hint.
 	uint64_t *DBPart;	// Streamed partition
 	uint32_t *prfSelectVals; 
 
-  // Arrays used to send and receive data from servers
-	bool *bvec;			// Select bits to send to server. 0 selects that index to be included in parity b0. 1 selects that index to be included in parity b1. 
-	uint32_t *Svec; 	// Indices sent to server
-	uint64_t *Response_b0; // Parity of entries with select bit = 0 received from the server
-	uint64_t *Response_b1; // Parity of entries with select bit = 1 received from the server
-	uint64_t *tmpEntry; // simulating a fake server 
-
 	PRFHintID prf;
+	Arena arena; // Owns every array above
+	unique_ptr<Context> Main; // Context of the Online calls without one
 
 };
 
@@ -68,7 +134,11 @@ The second server is used to generate hints and to replenish hints.
 class TwoSVClient
 {
 public:
-	TwoSVClient(uint32_t LogN, uint32_t EntryB); 
+	// geo must match the servers, see OneSVClient.
+	TwoSVClient(uint32_t LogN, uint32_t EntryB, Geometry geo = Geometry()); 
+	// Bytes the client stores for hints.
+	static uint64_t storageBytes(uint32_t LogN, uint32_t EntryB, Geometry geo = Geometry());
+	double invalidRate() const; // See OneSVClient
 	/* Runs the offline phase with the offline server. */
 	void Offline(TwoSVServer & offline_server);
 	/* Runs a single query with the online server, then replenishes a hint with the offline server. 
@@ -78,35 +148,49 @@ public:
 		query: database index of the desired entry
 		result: value of the desired entry
 	*/
-	void Online(TwoSVServer & online_server, TwoSVServer & offline_server, uint32_t query, uint64_t *result);
+	void Online(TwoSVServer & online_server, TwoSVServer & offline_server, uint64_t query, uint64_t *result);
+	QueryTimings LastTimings; // Stage timings of the last Online call
+	PerfCounters *Perf; // If set, hardware counters are attributed to the offline phase and the stages of Online
+
+	// Concurrent queries, see OneSVClient.
+	typedef QueryContext<PRFPartitionID> Context;
+	Context *newContext(); // The caller owns the context
+	void Online(TwoSVServer & online_server, TwoSVServer & offline_server, uint64_t query, uint64_t *result, Context &ctx);
+
+	// See OneSVClient.
+	void enablePrecompute(uint32_t Capacity);
+	unique_ptr<HintCache<PRFPartitionID>> Precompute;
+
+	// Returns the index of a hint that contains query, or M if there is none. Public so that it can be benchmarked on its own.
+	uint64_t FindHint(uint64_t query);
 
 private:
-	uint16_t NextDummyIdx();
-	uint16_t prfDummyIndices [8]; // Stores dummy indices to send to server
-	uint64_t dummyIdxUsed;
+	// See OneSVClient.
+	bool HasQuery(PRFPartitionID &prf, uint64_t i, uint64_t query);
+	uint64_t FindHint(PRFPartitionID &prf, uint64_t query, uint64_t start);
+	uint64_t ClaimHint(PRFPartitionID &prf, uint64_t query);
 
-	uint32_t N; // Number of database entries
+	uint32_t NextDummyIdx();
+	uint32_t prfDummyIndices [8]; // Stores dummy indices to send to server
+	atomic<uint64_t> dummyIdxUsed;
+
+	uint64_t N; // Number of database entries
 	uint32_t B; // Size of one entry is B * 8 bytes
 	
-	uint32_t PartNum; // Number of partitions = sqrt(N)
+	uint32_t PartNum; // Number of partitions, sqrt(N) by default
 	uint32_t PartSize; // Number of entries in one partition
 	uint32_t lambda; // Correctness parameter
 	uint32_t M; // Number of hints
-	uint64_t LastHintID; // Last hint ID used
+	atomic<uint64_t> LastHintID; // Last hint ID used
 
-	// Hints are stored as arrays. Each hint consists of a HintID, a parity, an indicator bit, an extra partition + offset, and a cutoff for the PRF value.
-	uint32_t *HintID;	// Array of hintIDs for each hint.
+	// Each hint consists of a HintID, a cutoff for the PRF value, an extra entry, an indicator bit, and a parity.
+	// The metadata is packed into one HintMeta record per hint. Parities are kept in a separate array since the online scan does not read them.
+	HintMeta *Hints; // Metadata of the M hints. The flag bit is the indicator bit. (See algorithm 3.)
+	uint16_t *ExtraHi; // Bits 31 and up of the extra entry of each hint, nullptr unless N > 2^31
+	atomic<bool> *Claimed; // Set while a query is using the hint
 	uint64_t *Parity; // Array of parities for each hint.
-	uint8_t *IndicatorBit; // Array storing the indicator bit for each hint. (See algorithm 3.) Each uint8_t packs 8 indicator bits.
-	uint16_t *ExtraPart;	// Array storing the extra partition for each hint
-	uint16_t *ExtraOffset; // Array storing the extra offset for each hint
-	uint32_t *SelectCutoff; // Array storing the PRF cutoff value for each hint.
 	PRFPartitionID prf;
 
-  // Arrays used to send and receive data from servers
-	bool *bvec;			// Select bits to send to server. 0 selects that index to be included in parity b0. 1 selects that index to be included in parity b1. 
-	uint32_t *Svec; 	// Database indices sent to server.
-	uint64_t *Response_b0; // Parity of entries with select bit = 0 received from server.
-	uint64_t *Response_b1; // Parity of entries with select bit = 1 received from server.
-	uint64_t *tmpEntry; // simulating a fake server 
+	Arena arena; // Owns every array above
+	unique_ptr<Context> Main; // Context of the Online calls without one
 };
\ No newline at end of file
@@ -0,0 +1,31 @@
+#pragma once
+#include <cstdint>
+#include "utils.h"
+
+using namespace std;
+
+/*
+Deterministic synthetic database. The database is the AES-CTR keystream of a key derived from Seed: 
+bytes [16c, 16c+16) are the encryption of the block with counter c, so entry i occupies bytes [i * EntrySize, (i+1) * EntrySize) of the stream.
+Any range of entries can be generated independently, which lets fill split the database across threads and lets entry recompute a single entry from its index.
+*/
+class DBGenerator {
+  public:
+  DBGenerator(uint32_t EntryB, uint64_t Seed = 1);
+
+  // Writes entries [0, NumEntries) to DB with Threads threads, 0 for one per available CPU.
+  // Each thread generates one contiguous slice and is pinned to its own CPU, so the pages of a slice are first touched on the NUMA node of the thread that writes them.
+  void fill(uint64_t *DB, uint64_t NumEntries, uint32_t Threads = 0);
+  // Writes entries [First, First + Count) to out.
+  void fillRange(uint64_t *out, uint64_t First, uint64_t Count);
+  // Recomputes entry index into result.
+  void entry(uint64_t index, uint64_t *result);
+
+  uint64_t seed() const { return Seed; }
+
+  private:
+  uint32_t EntrySize; // Size of an entry in bytes
+  uint64_t Seed;
+  uint64_t Key[2];
+  ECB_Mode< AES >::Encryption enc_;
+};
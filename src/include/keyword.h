@@ -0,0 +1,66 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "client.h"
+#include "server.h"
+
+#define KEY_HASHES 3 // Candidate slots of a key, and index queries per lookup
+
+using namespace std;
+
+/*
+Cuckoo hashed layout of a key-value store in a database of N = 2^LogN entries, one slot per entry.
+Word 0 of a slot holds the tag of its key, the other EntrySize - 8 bytes hold the value. Empty slots have tag 0.
+A key may sit in any of its KEY_HASHES candidate slots. With three candidates the keys can be placed up to a load of about 90%.
+The layout is public: clients and servers only have to agree on LogN, EntrySize and Seed.
+*/
+class CuckooLayout {
+  public:
+  CuckooLayout(uint32_t LogN, uint32_t EntryB, uint64_t Seed = 1);
+
+  // Candidate slot h (0 <= h < KEY_HASHES) of key.
+  uint64_t slot(uint64_t key, uint32_t h) const;
+  // Tag stored with key. Distinct keys have distinct tags, so a matching tag identifies the key.
+  uint64_t tag(uint64_t key) const;
+
+  /* Places Count keys with their values (valueWords() words each, contiguous in Values) into DB, which holds databaseWords(LogN, EntrySize) words.
+  Returns false if a key could not be placed, in which case the table is too full for this seed. */
+  bool build(uint64_t *DB, const uint64_t *Keys, const uint64_t *Values, uint64_t Count) const;
+
+  uint32_t logN() const { return LogN; }
+  uint32_t entrySize() const { return EntrySize; }
+  uint32_t valueWords() const { return EntrySize / 8 - 1; }
+  uint64_t seed() const { return Seed; }
+
+  private:
+  uint32_t LogN;
+  uint32_t EntrySize; // Size of an entry in bytes
+  uint64_t Seed;
+  uint64_t HashKeys[KEY_HASHES]; // Derived from Seed, one per candidate slot
+  uint64_t TagKey;
+};
+
+// Allocates a database like initDatabase and places the keys in it, trying the seeds layout.seed(), layout.seed() + 1, ... until one works.
+// layout is set to the layout that was used. Returns false if no seed works, the database is then too small for the keys and *DB is set to nullptr.
+bool initKeywordDatabase(uint64_t **DB, CuckooLayout &layout, const uint64_t *Keys, const uint64_t *Values, uint64_t Count);
+
+/*
+Looks up keys through the index-based protocol. A lookup makes one Online query for each of the KEY_HASHES candidate slots of the key,
+also when an earlier slot already matched, so the servers see the same queries for every key, present or not.
+*/
+class KeywordClient {
+  public:
+  KeywordClient(const CuckooLayout &layout);
+
+  // Returns whether key is in the database and copies its value (layout.valueWords() words) to value if it is.
+  bool Lookup(OneSVClient &client, OneSVServer &server, uint64_t key, uint64_t *value);
+  bool Lookup(TwoSVClient &client, TwoSVServer &online_server, TwoSVServer &offline_server, uint64_t key, uint64_t *value);
+
+  private:
+  // Copies the value of the first slot in Slots whose tag matches key.
+  bool Match(uint64_t key, uint64_t *value);
+
+  CuckooLayout layout;
+  uint32_t B; // Size of one entry is B * 8 bytes
+  vector<uint64_t> Slots; // The KEY_HASHES entries read by the last lookup
+};
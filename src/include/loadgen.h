@@ -0,0 +1,61 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Generates the sequence of database indices queried during a benchmark run.
+class QueryStream {
+  public:
+  enum Dist {
+    Diagonal, // Entry i of partition i, the original benchmark pattern
+    Uniform, // Uniformly random indices
+    Zipf, // Zipf-distributed popularity over randomly placed indices
+    Trace // Indices replayed from a file, one per line, wrapping around at the end
+  };
+
+  QueryStream(Dist dist, uint32_t LogN, double ZipfS = 0.99, string TraceFile = "", uint64_t seed = 1);
+  uint64_t next();
+
+  // Parses a distribution name (diagonal, uniform, zipf, trace). Returns false if it is unknown.
+  static bool parseDist(const string &name, Dist &dist);
+  static string distName(Dist dist);
+
+  private:
+  uint64_t sampleZipf();
+  double hIntegral(double x);
+  double hIntegralInverse(double x);
+  double h(double x);
+
+  Dist dist;
+  uint32_t LogN;
+  uint64_t N;
+  uint64_t count; // Queries generated so far
+  mt19937_64 gen;
+  vector<uint64_t> trace;
+
+  // Rejection-inversion sampler state (Hörmann and Derflinger), O(1) memory for any N.
+  double s;
+  double hIntegralX1;
+  double hIntegralN;
+  double sThreshold;
+};
+
+// Open-loop Poisson arrivals at Rate queries per second. With a rate of 0, each query arrives as soon as the previous one completes.
+class ArrivalProcess {
+  public:
+  ArrivalProcess(double Rate, uint64_t seed = 2);
+  // Waits until the next arrival and returns its scheduled time. Queries that fall behind are issued immediately,
+  // so latency measured from the scheduled time includes queueing delay.
+  chrono::steady_clock::time_point wait();
+
+  private:
+  double Rate;
+  bool started;
+  chrono::steady_clock::time_point nextArrival;
+  mt19937_64 gen;
+  exponential_distribution<double> gap;
+};
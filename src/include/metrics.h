@@ -0,0 +1,118 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+/*
+Low overhead protocol metrics. Every thread updates its own block of counters with plain relaxed stores, 
+snapshots sum the blocks of all threads. Compile with -DS3PIR_NO_METRICS to remove every update from the hot paths.
+*/
+class Metrics {
+  public:
+  enum Counter {
+    HintSearches, // Online hint searches
+    HintsScanned, // Hints walked by the online hint searches
+    InvalidHints, // Hints for which FindCutoff found no cutoff
+    BackupUsedAgain, // Queries answered with a hint replenished from a backup hint
+    BackupHintsSkipped, // Invalid backup hints skipped during replenishment
+    DBBytesOffline, // Database bytes read by the offline phase
+    DBBytesOnline, // Database bytes read answering online queries
+    DBBytesReplenish, // Database bytes read replenishing hints
+    NumCounters
+  };
+  enum Gauge {
+    BackupHintsLeft, // Unused backup hints of the one server client
+    NumGauges
+  };
+  enum Timer {
+    ClientOffline,
+    ClientGenerate,
+    ClientAnswer,
+    ClientReplenish,
+    ServerAnswer,
+    ServerReplenish,
+    ServerOfflineHints,
+    NumTimers
+  };
+
+  // Counters and timers of one thread, only written by that thread.
+  struct Block {
+    atomic<uint64_t> counters[NumCounters];
+    atomic<uint64_t> timerNs[NumTimers];
+    atomic<uint64_t> timerCount[NumTimers];
+  };
+
+  struct Snapshot {
+    uint64_t counters[NumCounters];
+    uint64_t gauges[NumGauges];
+    uint64_t timerNs[NumTimers];
+    uint64_t timerCount[NumTimers];
+  };
+
+  // Updates can be switched off at runtime, e.g. to measure their overhead.
+  static bool Enabled;
+
+  static void add(Counter c, uint64_t value) {
+    if (!Enabled) return;
+    atomic<uint64_t> &v = local().counters[c];
+    v.store(v.load(memory_order_relaxed) + value, memory_order_relaxed);
+  }
+  static void set(Gauge g, uint64_t value) {
+    if (!Enabled) return;
+    gauges[g].store(value, memory_order_relaxed);
+  }
+  static void time(Timer t, uint64_t ns) {
+    if (!Enabled) return;
+    Block &b = local();
+    b.timerNs[t].store(b.timerNs[t].load(memory_order_relaxed) + ns, memory_order_relaxed);
+    b.timerCount[t].store(b.timerCount[t].load(memory_order_relaxed) + 1, memory_order_relaxed);
+  }
+
+  // Sums the counters and timers of every thread.
+  static Snapshot snapshot();
+  static void reset();
+  // Exports a snapshot in the Prometheus text exposition format.
+  static string prometheus();
+  static string json();
+
+  private:
+  static Block &local() {
+    static thread_local Block *block = nullptr;
+    if (!block)
+      block = registerBlock();
+    return *block;
+  }
+  static Block *registerBlock();
+  static atomic<uint64_t> gauges[NumGauges];
+};
+
+// Adds the time spent in the enclosing scope to a timer.
+class ScopedTimer {
+  public:
+  ScopedTimer(Metrics::Timer t) : t(t), on(Metrics::Enabled) {
+    if (on) start = chrono::steady_clock::now();
+  }
+  ~ScopedTimer() {
+    if (on) Metrics::time(t, chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+  }
+
+  private:
+  Metrics::Timer t;
+  bool on;
+  chrono::steady_clock::time_point start;
+};
+
+#ifdef S3PIR_NO_METRICS
+#define METRICS_ADD(counter, value) do {} while (0)
+#define METRICS_SET(gauge, value) do {} while (0)
+#define METRICS_TIME(timer, ns) do {} while (0)
+#define METRICS_SCOPED_TIMER(timer) do {} while (0)
+#else
+#define METRICS_ADD(counter, value) Metrics::add(Metrics::counter, value)
+#define METRICS_SET(gauge, value) Metrics::set(Metrics::gauge, value)
+#define METRICS_TIME(timer, ns) Metrics::time(Metrics::timer, ns)
+#define METRICS_SCOPED_TIMER(timer) ScopedTimer metrics_scoped_timer(Metrics::timer)
+#endif
@@ -0,0 +1,60 @@
+#pragma once
+#include <cstdint>
+
+using namespace std;
+
+/*
+Hardware performance counters of the calling thread, attributed to protocol phases.
+The counters are opened as one perf_event_open group and read at every phase boundary, the difference to the previous read is added to the phase that just ended.
+Events the kernel or the CPU does not support are left out; if none can be opened, available() is false and every call is a no-op.
+*/
+class PerfCounters {
+  public:
+  enum Event {
+    Cycles,
+    Instructions,
+    LLCMisses, // Last level cache misses
+    DTLBMisses, // Data TLB load misses
+    NumEvents
+  };
+  enum Phase {
+    Offline, // Client offline phase, including the offline server
+    Generate, // Finding a hint and building the query
+    Answer, // Server answering the query and decoding the result
+    Replenish, // Replenishing the used hint
+    NumPhases
+  };
+
+  PerfCounters();
+  ~PerfCounters();
+  PerfCounters(const PerfCounters &) = delete;
+  PerfCounters &operator=(const PerfCounters &) = delete;
+
+  bool available() const { return Count > 0; }
+  bool has(Event e) const { return Index[e] >= 0; }
+  // Ends the current phase, if any, and starts counting for phase p.
+  void begin(Phase p);
+  // Ends the current phase.
+  void end();
+  // Counts of e accumulated over all occurrences of phase p, scaled up if the kernel multiplexed the group.
+  uint64_t total(Phase p, Event e) const { return Totals[p][e]; }
+  // Number of times phase p was begun.
+  uint64_t occurrences(Phase p) const { return Occurrences[p]; }
+  static const char *eventName(Event e);
+  static const char *phaseName(Phase p);
+
+  private:
+  // Reads the group into values, indexed by Event.
+  bool read(uint64_t *values);
+  // Reads the group and adds the counts since the last mark to the current phase.
+  void mark();
+
+  int Fds[NumEvents];
+  int Index[NumEvents]; // Position of each event in the group read, -1 if it could not be opened
+  int Leader;
+  int Count; // Events in the group
+  int Current; // Phase being counted, -1 for none
+  uint64_t Last[NumEvents]; // Values at the start of the current phase
+  uint64_t Totals[NumPhases][NumEvents];
+  uint64_t Occurrences[NumPhases];
+};
@@ -0,0 +1,199 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "utils.h"
+#include "arena.h"
+
+/*
+Builds the select bits and offsets sent to the server for one hint. Shared by both clients.
+All PRF rows of the hint are expanded in one batch up front, dummy offsets are drawn in bulk, 
+and the vectors are then built with a branch-free loop the compiler vectorizes.
+*/
+class QueryBuilder {
+  public:
+  // Allocates scratch space for PartNum partitions from arena.
+  void init(Arena &arena, uint32_t PartNum, uint32_t PartSize);
+
+  // Expands the v values and offsets of every partition for hintID.
+  template<typename PRF>
+  void expand(PRF &prf, uint32_t hintID) {
+    prf.expandHint(hintID, PartNum, SelectVals, Offsets, BlockIn, BlockOut);
+  }
+
+  // Number of dummy indices drawDummies consumes when dummyIdxUsed is a multiple of 8. Concurrent queries claim this many from a shared counter.
+  template<typename PRF>
+  uint64_t dummySpan(PRF &prf) const {
+    uint32_t s = prf.idxShift();
+    return (uint64_t) ((PartNum + (1 << s) - 1) >> s) << s;
+  }
+
+  // Draws PartNum dummy offsets from the dummy PRF stream, advancing dummyIdxUsed past them. Follows the same stream as NextDummyIdx.
+  template<typename PRF>
+  void drawDummies(PRF &prf, uint64_t &dummyIdxUsed) {
+    uint32_t s = prf.idxShift();
+    uint64_t first = (dummyIdxUsed + (1 << s) - 1) >> s;
+    uint32_t blocks = (PartNum + (1 << s) - 1) >> s;
+    for (uint32_t i = 0; i < blocks; i++)
+      PRFDummyBlock(BlockIn + 4 * i, first + i);
+    dummyIdxUsed = (first + blocks) << s;
+    if (prf.wide()){
+      prf.evaluateBlocks((uint8_t*) Dummies, BlockIn, blocks);
+      return;
+    }
+    prf.evaluateBlocks((uint8_t*) BlockOut, BlockIn, blocks);
+    for (uint32_t k = 0; k < PartNum; k++)
+      Dummies[k] = ((uint16_t*) BlockOut)[k];
+  }
+
+  /* Fills bvec and Svec from the expanded rows. 
+  A partition is selected if (v < cutoff) ^ flip, and its real offset is sent if the selection equals indicator, a dummy offset otherwise.
+  The query's partition gets a dummy offset on the opposite side, the extra partition gets the extra offset on the indicator side.
+  Every select bit is flipped by shouldFlip. */
+  void build(uint32_t cutoff, bool flip, bool indicator, bool shouldFlip, uint32_t queryPart, uint64_t extraIdx, bool *bvec, uint32_t *Svec);
+
+  uint32_t *SelectVals; // v value of each partition
+  uint32_t *Offsets; // r value of each partition
+
+  private:
+  uint32_t PartNum;
+  uint32_t PartSize;
+  uint32_t *Dummies; // Dummy offset for each partition
+  uint32_t *BlockIn; // PRF input blocks
+  uint32_t *BlockOut; // PRF output blocks
+};
+
+/*
+Bounded cache of expanded hint rows, the v values and offsets QueryBuilder::expand computes for a hint ID.
+The client queues the ID of every hint it replenishes, and a background thread expands them at the lowest scheduling priority, 
+so it only runs when a CPU is otherwise idle. Online copies the rows of its hint from the cache when they are there.
+Recently replenished hints hold recently queried entries as their extra entry, so skewed workloads tend to query them again.
+The cache is direct mapped on the hint ID. Since new hint IDs are consecutive, it holds the last Capacity hints queued.
+Online never waits for the worker: the worker may be preempted while it holds the lock, so take and prefetch give up when the lock is busy.
+*/
+template<typename PRF>
+class HintCache {
+  public:
+  HintCache(uint32_t PartNum, uint32_t Capacity, bool wide) : Hits(0), Misses(0), PartNum(PartNum), Capacity(Capacity), prf(AES_KEY), Generation(0), Stop(false) {
+    assert(Capacity > 0);
+    prf.setWide(wide);
+    uint32_t padded = (PartNum + 7) / 8 * 8;
+    IDs = arena.alloc<uint64_t>(Capacity);
+    for (uint32_t i = 0; i < Capacity; i++)
+      IDs[i] = Empty;
+    SelectVals = arena.alloc<uint32_t>((uint64_t) Capacity * padded);
+    Offsets = arena.alloc<uint32_t>((uint64_t) Capacity * padded);
+    RowSelect = arena.alloc<uint32_t>(padded);
+    RowOffsets = arena.alloc<uint32_t>(padded);
+    BlockIn = arena.alloc<uint32_t>(4 * padded);
+    BlockOut = arena.alloc<uint32_t>(4 * padded);
+    Worker = thread(&HintCache::run, this);
+  }
+
+  ~HintCache() {
+    {
+      lock_guard<mutex> guard(Lock);
+      Stop = true;
+    }
+    Wake.notify_one();
+    Worker.join();
+  }
+
+  // Queues hintID to be expanded. IDs that would be evicted before they are expanded are dropped, as is hintID if the lock is busy.
+  void prefetch(uint32_t hintID) {
+    {
+      unique_lock<mutex> guard(Lock, try_to_lock);
+      if (!guard.owns_lock())
+        return;
+      Pending.push_back(hintID);
+      if (Pending.size() > Capacity)
+        Pending.pop_front();
+    }
+    Wake.notify_one();
+  }
+
+  // Copies the rows of hintID to selectVals and offsets and returns true if they are cached. A busy lock counts as a miss.
+  bool take(uint32_t hintID, uint32_t *selectVals, uint32_t *offsets) {
+    unique_lock<mutex> guard(Lock, try_to_lock);
+    if (!guard.owns_lock()){
+      Misses++;
+      return false;
+    }
+    uint32_t slot = hintID % Capacity;
+    if (IDs[slot] != hintID){
+      Misses++;
+      return false;
+    }
+    memcpy(selectVals, SelectVals + (uint64_t) slot * padded(), PartNum * sizeof(uint32_t));
+    memcpy(offsets, Offsets + (uint64_t) slot * padded(), PartNum * sizeof(uint32_t));
+    Hits++;
+    return true;
+  }
+
+  // Drops every cached and queued hint, hint IDs are reused after a new offline phase.
+  void clear() {
+    lock_guard<mutex> guard(Lock);
+    Pending.clear();
+    for (uint32_t i = 0; i < Capacity; i++)
+      IDs[i] = Empty;
+    // The hint the worker is expanding right now must not be stored
+    Generation++;
+  }
+
+  atomic<uint64_t> Hits; // Online calls that found their hint in the cache
+  atomic<uint64_t> Misses; // Online calls that expanded their hint themselves
+
+  private:
+  static const uint64_t Empty = ~0ull;
+
+  uint32_t padded() const { return (PartNum + 7) / 8 * 8; }
+
+  void run() {
+    // Only use CPU time that nothing else wants
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+    unique_lock<mutex> guard(Lock);
+    while (true){
+      Wake.wait(guard, [this]{ return Stop || !Pending.empty(); });
+      if (Stop)
+        return;
+      uint32_t hintID = Pending.front();
+      Pending.pop_front();
+      uint64_t generation = Generation;
+      guard.unlock();
+      prf.expandHint(hintID, PartNum, RowSelect, RowOffsets, BlockIn, BlockOut);
+      guard.lock();
+      if (generation != Generation)
+        continue;
+      uint32_t slot = hintID % Capacity;
+      memcpy(SelectVals + (uint64_t) slot * padded(), RowSelect, PartNum * sizeof(uint32_t));
+      memcpy(Offsets + (uint64_t) slot * padded(), RowOffsets, PartNum * sizeof(uint32_t));
+      IDs[slot] = hintID;
+    }
+  }
+
+  uint32_t PartNum;
+  uint32_t Capacity; // Number of hints the cache holds
+  PRF prf; // Used by the worker only
+  uint64_t *IDs; // Hint ID held by each slot, Empty if none
+  uint32_t *SelectVals; // v values of each slot
+  uint32_t *Offsets; // r values of each slot
+  uint32_t *RowSelect; // Rows the worker is expanding
+  uint32_t *RowOffsets;
+  uint32_t *BlockIn; // PRF input blocks of the worker
+  uint32_t *BlockOut; // PRF output blocks of the worker
+  Arena arena; // Owns every array above
+
+  mutex Lock; // Guards everything but the rows the worker is expanding
+  condition_variable Wake;
+  deque<uint32_t> Pending; // Hint IDs waiting to be expanded, oldest first
+  uint64_t Generation; // Incremented by clear
+  bool Stop;
+  thread Worker;
+};
@@ -6,6 +6,9 @@
 #include "cryptopp/files.h"
 #include "cryptopp/osrng.h"
 #include "utils.h"
+#include "storage.h"
+#include "arena.h"
+#include "dbgen.h"
 
 using namespace std;
 using namespace CryptoPP;
@@ -13,52 +16,71 @@ using namespace CryptoPP;
 // Server class for the one server variant
 class OneSVServer {
   public:
-  OneSVServer(uint64_t * DB_ptr, uint32_t LogN, uint32_t EntryB);
-  void getEntry(uint32_t index, uint64_t *result);
+  /* If disk is set, entries are read from the disk-backed database instead of DB_ptr. Otherwise, if lazy is set, every entry is recomputed by lazy when it is read and DB_ptr is unused. 
+  geo must match the client, see Geometry. */
+  OneSVServer(uint64_t * DB_ptr, uint32_t LogN, uint32_t EntryB, DiskDB * disk = nullptr, DBGenerator * lazy = nullptr, Geometry geo = Geometry());
+  void getEntry(uint64_t index, uint64_t *result);
   /* Generate a single query using the online server. */
   void onlineQuery(bool* bvec, uint32_t *Svec, uint64_t *b0, uint64_t *b1);
 
   private:
   uint64_t * DB; // Pointer to database array
-  uint32_t N; // Number of database entries
+  uint64_t N; // Number of database entries
   uint32_t B; // Size of one entry is B * 8 bytes
   uint32_t EntrySize; // Size of an entry in bytes
 
-	uint32_t PartNum; // Number of partitions = sqrt(N)
+	uint32_t PartNum; // Number of partitions, sqrt(N) by default
 	uint32_t PartSize; // Number of entries in one partition
 	uint32_t lambda; // Correctness parameter
 	uint32_t M; // Number of hints
   uint64_t * tmpEntry;
+
+  DiskDB * Disk; // Disk-backed database, nullptr if the database is in memory
+  DBGenerator * Lazy; // Generator of the entries, nullptr if they are stored
+  uint64_t * batchIdx; // Database indices of a batched disk read
+  uint64_t * batchBuf; // Entries returned by a batched disk read
+  Arena arena; // Owns every array above
 };
 
 // Server class for the two server variant
 class TwoSVServer {
   public:
-  TwoSVServer(uint64_t * DB_ptr, uint32_t LogN, uint32_t EntryB);
-  void getEntryFromServer(uint32_t index, uint64_t *result);
-  /* Runs the offline phase, generating hints from hintID 0 to M. Does not allocate memory. 
+  /* If disk is set, entries are read from the disk-backed database instead of DB_ptr. Otherwise, if lazy is set, every entry is recomputed by lazy when it is read and DB_ptr is unused. 
+  geo must match the client, see Geometry. */
+  TwoSVServer(uint64_t * DB_ptr, uint32_t LogN, uint32_t EntryB, DiskDB * disk = nullptr, DBGenerator * lazy = nullptr, Geometry geo = Geometry());
+  void getEntryFromServer(uint64_t index, uint64_t *result);
+  /* Runs the offline phase, generating hints from hintID 0 to M. Fills in the cutoff and extra entry of each hint, with the indicator bit set. Does not allocate memory. 
+  ExtraHi receives bits 31 and up of the extra indices, it must be set for databases of more than 2^31 entries.
   */
-  void generateOfflineHints(uint32_t M, uint64_t * Parity, uint16_t * ExtraPart, uint16_t * ExtraOffset, uint32_t * SelectCutoff);
+  void generateOfflineHints(uint32_t M, uint64_t * Parity, HintMeta * Hints, uint16_t * ExtraHi = nullptr);
   /* Generate parities for a hintID using the offline server. Both parities for b = 0 and b = 1 are returned continguously in the result pointer, with b=0 being the first parity.*/
   void replenishHint(uint64_t hintID, uint64_t * result, uint32_t * SelectCutoff);
   /* Generate a single query using the online server. */
   void onlineQuery(bool * bvec, uint32_t *Svec, uint64_t *b0, uint64_t *b1);
 
   private:
-	uint16_t NextDummyIdx();
-	uint16_t prfDummyIndices [8];
+	uint32_t NextDummyIdx();
+	uint32_t prfDummyIndices [8];
 	uint64_t dummyIdxUsed;
 
   uint64_t * DB; // Pointer to database array
-  uint32_t N; // Number of database entries
+  uint64_t N; // Number of database entries
   uint32_t B; // Size of one entry is B * 8 bytes
   uint32_t EntrySize; // Size of an entry in bytes
 
-	uint32_t PartNum; // Number of partitions = sqrt(N)
+	uint32_t PartNum; // Number of partitions, sqrt(N) by default
 	uint32_t PartSize; // Number of entries in one partition
 	uint32_t lambda; // Correctness parameter
 	uint32_t M; // Number of hints
   uint64_t * tmpEntry; // Preallocated space for operations involving a database entry
 
+  DiskDB * Disk; // Disk-backed database, nullptr if the database is in memory
+  DBGenerator * Lazy; // Generator of the entries, nullptr if they are stored
+  uint64_t * batchIdx; // Database indices of a batched disk read
+  uint64_t * batchBuf; // Entries returned by a batched disk read
+  uint32_t * prfSelectVals; // PRF v values of the hint being generated, one per partition
+  uint32_t * prfSelectValsCopy; // Scratch copy of prfSelectVals consumed by FindCutoff
+  Arena arena; // Owns every array above
+
 	PRFPartitionID prf;
 };
\ No newline at end of file
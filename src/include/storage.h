@@ -0,0 +1,54 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include "utils.h"
+#include "arena.h"
+#include "dbgen.h"
+
+using namespace std;
+
+struct io_uring;
+
+/*
+Database stored in a file on local disk. Entry i occupies bytes [i * EntrySize, (i+1) * EntrySize) of the file.
+The random reads of a query are submitted as one batch: a single io_uring submission when built with USE_LIBURING, one pread per entry otherwise.
+The first CachedParts partitions are pinned in memory as a hot partition cache and never hit the disk.
+*/
+class DiskDB {
+  public:
+  // LogPartNum is the log2 of the number of partitions of the scheme, 0 for the default of LogN / 2.
+  DiskDB(string path, uint32_t LogN, uint32_t EntryB, uint32_t CachedParts = 0, bool DirectIO = false, uint32_t LogPartNum = 0);
+  ~DiskDB();
+
+  // Reads a single entry into result.
+  void readEntry(uint64_t index, uint64_t *result);
+  // Reads Count entries into result, entry i is stored at result + i * B. Records the latency of the whole batch.
+  void readBatch(const uint64_t *indices, uint32_t Count, uint64_t *result);
+  // Writes the N entries of an in-memory database to path.
+  static void writeFile(string path, uint64_t *DB, uint32_t LogN, uint32_t EntryB);
+  // Writes the N entries of a generated database to path without holding it in memory.
+  static void writeFile(string path, DBGenerator &gen, uint32_t LogN, uint32_t EntryB);
+
+  LatencyStats Latency; // Latency of every readBatch call
+  uint64_t CacheHits; // Entries served from the hot partition cache
+  uint64_t DiskReads; // Entries read from disk
+
+  private:
+  // Reads a single entry from the file, bypassing the cache.
+  void readFromDisk(uint64_t index, uint64_t *result);
+
+  Arena arena;
+  int fd;
+  bool Direct; // File was opened with O_DIRECT, reads go through aligned bounce buffers
+  uint32_t B; // Size of one entry is B * 8 bytes
+  uint32_t EntrySize; // Size of an entry in bytes
+  uint32_t PartSize; // Number of entries in one partition
+  uint64_t CachedEntries; // Entries [0, CachedEntries) are held in Cache
+  uint64_t *Cache;
+
+  uint32_t SpanSize; // Bytes read per entry with O_DIRECT, a multiple of the block size
+  uint32_t BatchCap; // Number of entries the bounce buffer and ring can hold
+  uint8_t *Bounce; // Block aligned buffer for O_DIRECT reads
+  uint64_t *Pending; // Batch positions that were not served from the cache
+  io_uring *Ring;
+};
@@ -6,27 +6,111 @@
 #include "cryptopp/files.h"
 #include "cryptopp/osrng.h"
 #include <cassert>
+#include <vector>
 
 #define AES_KEY "1234567812345678"
-#define LAMBDA 80
+#define LAMBDA 80 // Default correctness parameter
+#define MAX_LOG_N 47 // Largest log2 of the database size. ExtraHi holds bits 31 to 46 of an extra entry.
+// Smallest log2 of the number of partitions the command line accepts. FindCutoff looks for the median in a fixed band around 2^31,
+// which the median of few partitions often misses: about 5% of the hints get no cutoff with 2^8 partitions and over half with 2^5.
+#define MIN_LOG_PART_NUM 8
 
 using namespace std;
 using namespace CryptoPP;
 
+/*
+Shape of the scheme for a database of 2^LogN entries: 2^LogPartNum partitions of 2^(LogN - LogPartNum) entries each, and M = Lambda * PartSize hints.
+Zero fields pick the defaults, 2^(LogN/2) partitions and LAMBDA. Clients and servers of one run must use the same geometry.
+*/
+struct Geometry {
+  explicit Geometry(uint32_t LogPartNum = 0, uint32_t Lambda = 0, bool Wide = false) : LogPartNum(LogPartNum), Lambda(Lambda), Wide(Wide) {}
+
+  // Fills in the defaults and sets Wide if the compact PRF layout cannot address this geometry:
+  // it holds 16-bit offsets and partition numbers and 31-bit extra entries.
+  Geometry resolve(uint32_t LogN) const {
+    Geometry g = *this;
+    if (!g.LogPartNum) g.LogPartNum = LogN / 2;
+    if (!g.Lambda) g.Lambda = LAMBDA;
+    assert(g.LogPartNum < LogN && LogN - g.LogPartNum <= 31);
+    g.Wide = g.Wide || LogN > 31 || g.LogPartNum > 16 || LogN - g.LogPartNum > 16;
+    return g;
+  }
+
+  uint32_t LogPartNum;
+  uint32_t Lambda; // Correctness parameter
+  bool Wide; // Use the wide PRF layout even if the compact one would do
+};
+
+// Writes the 128-bit PRF input block for (word1, word2, word3) into blk, laid out the same way as evaluate().
+// The compact layout packs word2 into 16 bits. The wide layout gives every word its own 32 bits and sets the last word so the two layouts never share an input.
+inline void PRFBlock(uint32_t *blk, uint32_t word1, uint32_t word2, uint32_t word3, bool wide = false){
+  blk[0] = word1;
+  if (wide){
+    blk[1] = word2;
+    blk[2] = word3;
+    blk[3] = 1;
+    return;
+  }
+  blk[1] = (word3 << 16) | word2;
+  blk[2] = blk[3] = 0;
+}
+
+// Writes the PRF input block of dummy offset block c. The last word keeps the dummy stream apart from the hint inputs of both layouts,
+// and the counter has 64 bits so it never runs into them.
+inline void PRFDummyBlock(uint32_t *blk, uint64_t c){
+  blk[0] = c;
+  blk[1] = c >> 32;
+  blk[2] = 0;
+  blk[3] = 2;
+}
+
 // PRF across partition ID. 
 // A single PRF call generates the values of v for 4 consecutive partition numbers for a single hintID and the values of r for 8 consecutive partition numbers for a single hintID, packed in 128 bits.
+// In wide mode r is 32 bits and a call covers 4 partitions, for partitions larger than 2^16 entries.
 class PRFPartitionID{
   public:
-  PRFPartitionID(string keyStr){
+  PRFPartitionID(string keyStr) : Wide(false){
     assert(keyStr.size() == 16);
     SecByteBlock aesKey(reinterpret_cast<const CryptoPP::byte*>(keyStr.data()), AES::DEFAULT_KEYLENGTH);
     enc_.SetKey(aesKey, aesKey.size());
   }
   void evaluate(uint8_t *out, uint32_t word1, uint32_t word2, uint32_t word3){
-    uint32_t prfIn [4] = {word1, (word3 << 16) | word2};
+    uint32_t prfIn [4];
+    PRFBlock(prfIn, word1, word2, word3, Wide);
       enc_.ProcessData(out, (uint8_t*) prfIn, 16);
   }
 
+  void setWide(bool wide) { Wide = wide; }
+  bool wide() const { return Wide; }
+  // log2 of the number of r values one call generates
+  uint32_t idxShift() const { return Wide ? 2 : 3; }
+
+  // Generates the 1 << idxShift() r values (or dummy offsets) of one call, widened to 32 bits.
+  void evaluateIdx(uint32_t *out, uint32_t word1, uint32_t word2, uint32_t word3){
+    if (Wide){
+      evaluate((uint8_t*) out, word1, word2, word3);
+      return;
+    }
+    uint16_t ctxt [8];
+    evaluate((uint8_t*) ctxt, word1, word2, word3);
+    for (uint32_t i = 0; i < 8; i++)
+      out[i] = ctxt[i];
+  }
+
+  // Generates the 1 << idxShift() dummy offsets of dummy block c, widened to 32 bits.
+  void evaluateDummyIdx(uint32_t *out, uint64_t c){
+    uint32_t prfIn [4];
+    PRFDummyBlock(prfIn, c);
+    if (Wide){
+      enc_.ProcessData((uint8_t*) out, (uint8_t*) prfIn, 16);
+      return;
+    }
+    uint16_t ctxt [8];
+    enc_.ProcessData((uint8_t*) ctxt, (uint8_t*) prfIn, 16);
+    for (uint32_t i = 0; i < 8; i++)
+      out[i] = ctxt[i];
+  }
+
   // Returns b given a partition and hint ID
   bool PRF4Select(uint32_t hintID, uint32_t partID, uint32_t cutoff)
   {
@@ -36,14 +120,48 @@ class PRFPartitionID{
   }
 
   // Returns r given a partition and hint ID 
-  uint16_t PRF4Idx(uint32_t hintID, uint32_t partID)
+  uint32_t PRF4Idx(uint32_t hintID, uint32_t partID)
   {
+    if (Wide){
+      uint32_t ctxt [4];
+      evaluate((uint8_t*) ctxt, hintID, partID / 4, 2);
+      return ctxt[partID % 4];
+    }
     uint16_t ctxt [8];
     evaluate((uint8_t*) ctxt, hintID, partID / 8, 2);	
     return ctxt[partID % 8];	
   }
 
+  // Encrypts count input blocks with a single call so AES can pipeline across them.
+  void evaluateBlocks(uint8_t *out, const uint32_t *in, uint32_t count){
+    enc_.ProcessData(out, (const uint8_t*) in, 16 * count);
+  }
+
+  // Expands every PRF row of a hint in two batched calls: the v value and the offset r for each of the PartNum partitions.
+  // selectVals and offsets must have room for PartNum rounded up to a multiple of 8. blockIn and blockOut hold 4 * PartNum words.
+  void expandHint(uint32_t hintID, uint32_t PartNum, uint32_t *selectVals, uint32_t *offsets, uint32_t *blockIn, uint32_t *blockOut)
+  {
+    // Rows for consecutive partitions are already contiguous in the output
+    uint32_t selectBlocks = (PartNum + 3) / 4;
+    for (uint32_t i = 0; i < selectBlocks; i++)
+      PRFBlock(blockIn + 4 * i, hintID, i, 1, Wide);
+    evaluateBlocks((uint8_t*) selectVals, blockIn, selectBlocks);
+
+    uint32_t s = idxShift();
+    uint32_t idxBlocks = (PartNum + (1 << s) - 1) >> s;
+    for (uint32_t i = 0; i < idxBlocks; i++)
+      PRFBlock(blockIn + 4 * i, hintID, i, 2, Wide);
+    if (Wide){
+      evaluateBlocks((uint8_t*) offsets, blockIn, idxBlocks);
+      return;
+    }
+    evaluateBlocks((uint8_t*) blockOut, blockIn, idxBlocks);
+    for (uint32_t k = 0; k < PartNum; k++)
+      offsets[k] = ((uint16_t*) blockOut)[k];
+  }
+
   private:
+  bool Wide;
   // AES-128
 	ECB_Mode< AES >::Encryption enc_;
 };
@@ -51,18 +169,51 @@ class PRFPartitionID{
 
 // PRF across hint ID
 // A single PRF call generates the values of v for 4 consecutive hintIDs for a single partition number and the values of r for 8 consecutive hintIDs for a single partition number, packed in 128 bits.
+// In wide mode r is 32 bits and a call covers 4 hint IDs, for partitions larger than 2^16 entries.
 class PRFHintID{
   public:
-  PRFHintID(string keyStr){
+  PRFHintID(string keyStr) : Wide(false){
     assert(keyStr.size() == 16);
     SecByteBlock aesKey(reinterpret_cast<const CryptoPP::byte*>(keyStr.data()), AES::DEFAULT_KEYLENGTH);
     enc_.SetKey(aesKey, aesKey.size());
   }
   void evaluate(uint8_t *out, uint32_t word1, uint32_t word2, uint32_t word3){
-    uint32_t prfIn [4] = {word1, (word3 << 16) | word2};
+    uint32_t prfIn [4];
+    PRFBlock(prfIn, word1, word2, word3, Wide);
       enc_.ProcessData(out, (uint8_t*) prfIn, 16);
   }
 
+  void setWide(bool wide) { Wide = wide; }
+  bool wide() const { return Wide; }
+  // log2 of the number of r values one call generates
+  uint32_t idxShift() const { return Wide ? 2 : 3; }
+
+  // Generates the 1 << idxShift() r values (or dummy offsets) of one call, widened to 32 bits.
+  void evaluateIdx(uint32_t *out, uint32_t word1, uint32_t word2, uint32_t word3){
+    if (Wide){
+      evaluate((uint8_t*) out, word1, word2, word3);
+      return;
+    }
+    uint16_t ctxt [8];
+    evaluate((uint8_t*) ctxt, word1, word2, word3);
+    for (uint32_t i = 0; i < 8; i++)
+      out[i] = ctxt[i];
+  }
+
+  // Generates the 1 << idxShift() dummy offsets of dummy block c, widened to 32 bits.
+  void evaluateDummyIdx(uint32_t *out, uint64_t c){
+    uint32_t prfIn [4];
+    PRFDummyBlock(prfIn, c);
+    if (Wide){
+      enc_.ProcessData((uint8_t*) out, (uint8_t*) prfIn, 16);
+      return;
+    }
+    uint16_t ctxt [8];
+    enc_.ProcessData((uint8_t*) ctxt, (uint8_t*) prfIn, 16);
+    for (uint32_t i = 0; i < 8; i++)
+      out[i] = ctxt[i];
+  }
+
   // Returns an indicator bit given a partition number, hint ID, and cutoff value for the hintID. Indicator bit is flipped if flip is set to 1.
   bool PRF4Select(uint32_t hintID, uint32_t partID, uint32_t cutoff, bool flip = 0)
   {
@@ -72,24 +223,136 @@ class PRFHintID{
   }
 
   // Returns a partition offset given a partition number and hint ID 
-  uint16_t PRF4Idx(uint32_t hintID, uint32_t partID)
+  uint32_t PRF4Idx(uint32_t hintID, uint32_t partID)
   {
+    if (Wide){
+      uint32_t ctxt [4];
+      evaluate((uint8_t*) ctxt, hintID / 4, partID, 2);
+      return ctxt[hintID % 4];
+    }
     uint16_t ctxt [8];
     evaluate((uint8_t*) ctxt, hintID / 8, partID, 2);	
     return ctxt[hintID % 8];	
   }
 
+  // Encrypts count input blocks with a single call so AES can pipeline across them.
+  void evaluateBlocks(uint8_t *out, const uint32_t *in, uint32_t count){
+    enc_.ProcessData(out, (const uint8_t*) in, 16 * count);
+  }
+
+  // Expands every PRF row of a hint in two batched calls: the v value and the offset r for each of the PartNum partitions.
+  // selectVals and offsets must have room for PartNum rounded up to a multiple of 8. blockIn and blockOut hold 4 * PartNum words.
+  void expandHint(uint32_t hintID, uint32_t PartNum, uint32_t *selectVals, uint32_t *offsets, uint32_t *blockIn, uint32_t *blockOut)
+  {
+    // Each block covers 4 (or 8) hint IDs of one partition, we keep the lane of our hint.
+    for (uint32_t k = 0; k < PartNum; k++)
+      PRFBlock(blockIn + 4 * k, hintID / 4, k, 1, Wide);
+    evaluateBlocks((uint8_t*) blockOut, blockIn, PartNum);
+    for (uint32_t k = 0; k < PartNum; k++)
+      selectVals[k] = blockOut[4 * k + hintID % 4];
+
+    if (Wide){
+      for (uint32_t k = 0; k < PartNum; k++)
+        PRFBlock(blockIn + 4 * k, hintID / 4, k, 2, Wide);
+      evaluateBlocks((uint8_t*) blockOut, blockIn, PartNum);
+      for (uint32_t k = 0; k < PartNum; k++)
+        offsets[k] = blockOut[4 * k + hintID % 4];
+      return;
+    }
+    for (uint32_t k = 0; k < PartNum; k++)
+      PRFBlock(blockIn + 4 * k, hintID / 8, k, 2);
+    evaluateBlocks((uint8_t*) blockOut, blockIn, PartNum);
+    for (uint32_t k = 0; k < PartNum; k++)
+      offsets[k] = ((uint16_t*) blockOut)[8 * k + hintID % 8];
+  }
+
   private:
+  bool Wide;
   // AES-128
 	ECB_Mode< AES >::Encryption enc_;
 };
 
 
 // Reads an entry from a DB into result.
-void getEntryFromDB(uint64_t* DB, uint32_t index, uint64_t *result, uint32_t EntrySize);
+void getEntryFromDB(uint64_t* DB, uint64_t index, uint64_t *result, uint32_t EntrySize);
+
+// Allocates a database and fills it with entries of the DBGenerator seeded with Seed.
+void initDatabase(uint64_t** DB, uint64_t kLogDBSize, uint64_t kEntrySize, uint64_t Seed = 1);
+
+// Number of uint64s in a database of 2^kLogDBSize entries of kEntrySize bytes, as allocated by initDatabase.
+// With SimLargeServer the database only holds 2^kLogDBSize / kEntrySize entries, and entry i is stored entry i / kEntrySize.
+uint64_t databaseWords(uint64_t kLogDBSize, uint64_t kEntrySize);
+
+// Fills an allocated database with entries of the DBGenerator seeded with Seed, using all available CPUs.
+void fillDatabase(uint64_t* DB, uint64_t kLogDBSize, uint64_t kEntrySize, uint64_t Seed = 1);
+
+/* Given an array of PartNum prf values, finds the median value. May return 0 if algorithm does not find a median. 
+Overwrites prfVals. Filters with AVX-512 or AVX2 when the CPU supports it and selects the median with a histogram. */
+uint32_t FindCutoff(uint32_t *prfVals, uint32_t PartNum);
+
+/* Scalar reference implementation of FindCutoff. Returns the same cutoff. */
+uint32_t FindCutoffScalar(uint32_t *prfVals, uint32_t PartNum);
+
+// Collects latency samples in nanoseconds and reports percentiles over them.
+class LatencyStats {
+  public:
+  void add(uint64_t ns) { samples.push_back(ns); }
+  void clear() { samples.clear(); }
+  // Adds every sample of other, e.g. to combine the stats of several threads.
+  void merge(const LatencyStats &other) { samples.insert(samples.end(), other.samples.begin(), other.samples.end()); }
+  size_t count() const { return samples.size(); }
+  // Returns the p-th percentile (0 <= p <= 100) of the recorded samples, or 0 if there are none.
+  uint64_t percentile(double p) const;
+  double mean() const;
+  // Writes one csv row per non-empty log-scale bucket (8 buckets per power of two): prefix, lower bound (us), upper bound (us), count.
+  void writeHistogram(ostream &out, const string &prefix) const;
+
+  private:
+  vector<uint64_t> samples;
+};
+
+/*
+Metadata of a single hint, packed into 12 bytes so that the online scan reads one contiguous record per hint.
+The extra entry is stored as its database index (partition * PartSize + offset), which needs at most 31 bits for N <= 2^31.
+Larger databases keep bits 31 and up of the index in a separate ExtraHi array, see hintExtra and setHintExtra.
+The top bit holds the per-hint flag: the flip bit in the one server variant, the indicator bit in the two server variant.
+*/
+struct HintMeta {
+  uint32_t ID; // Hint ID the PRF is evaluated on
+  uint32_t Cutoff; // PRF cutoff value. 0 marks an invalid hint.
+  uint32_t Extra; // Bits 0-30: database index of the extra entry. Bit 31: flag.
+
+  uint32_t extraIdx() const { return Extra & 0x7fffffff; }
+  bool flag() const { return Extra >> 31; }
+  void setExtra(uint32_t index, bool flag) { Extra = index | ((uint32_t) flag << 31); }
+};
+
+// Hints are read by the scans of concurrent queries while their owner replenishes them, so the shared fields are accessed with relaxed atomics.
+// A scan may see a mix of the old and the new hint and has to check a match again once it has claimed the hint.
+inline HintMeta loadHint(const HintMeta *h){
+  HintMeta v;
+  v.ID = __atomic_load_n(&h->ID, __ATOMIC_RELAXED);
+  v.Cutoff = __atomic_load_n(&h->Cutoff, __ATOMIC_RELAXED);
+  v.Extra = __atomic_load_n(&h->Extra, __ATOMIC_RELAXED);
+  return v;
+}
+
+inline void storeHint(HintMeta *h, const HintMeta &v){
+  __atomic_store_n(&h->ID, v.ID, __ATOMIC_RELAXED);
+  __atomic_store_n(&h->Cutoff, v.Cutoff, __ATOMIC_RELAXED);
+  __atomic_store_n(&h->Extra, v.Extra, __ATOMIC_RELAXED);
+}
 
-// Initializes a database with random values.
-void initDatabase(uint64_t** DB, uint64_t kLogDBSize, uint64_t kEntrySize);
+// Returns the database index of the extra entry of hint i. ExtraHi is nullptr for databases of at most 2^31 entries.
+inline uint64_t hintExtra(const HintMeta *Hints, const uint16_t *ExtraHi, uint64_t i){
+  uint64_t index = Hints[i].extraIdx();
+  if (ExtraHi)
+    index |= (uint64_t) ExtraHi[i] << 31;
+  return index;
+}
 
-/* Given an array of PartNum prf values, finds the median value. May return 0 if algorithm does not find a median */
-uint32_t FindCutoff(uint32_t *prfVals, uint32_t PartNum);
\ No newline at end of file
+inline void setHintExtra(HintMeta *Hints, uint16_t *ExtraHi, uint64_t i, uint64_t index, bool flag){
+  Hints[i].setExtra(index & 0x7fffffff, flag);
+  if (ExtraHi)
+    ExtraHi[i] = index >> 31;
+}
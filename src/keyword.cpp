@@ -0,0 +1,139 @@
+#include <algorithm>
+#include <random>
+
+#include "keyword.h"
+
+#define MAX_KICKS 500 // Evictions tried before the insertion of a key gives up
+
+// Finalizer of MurmurHash3. A bijection on 64-bit values, so keys never share a tag.
+static inline uint64_t mix64(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdull;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ull;
+	x ^= x >> 33;
+	return x;
+}
+
+CuckooLayout::CuckooLayout(uint32_t LogN, uint32_t EntryB, uint64_t Seed) : LogN(LogN), EntrySize(EntryB), Seed(Seed)
+{
+	// Word 0 holds the tag, the value needs at least one more word
+	assert(EntryB >= 16 && EntryB % 8 == 0);
+	assert(LogN >= 1 && LogN < 64);
+	for (uint32_t h = 0; h < KEY_HASHES; h++)
+		HashKeys[h] = mix64(Seed * KEY_HASHES + h + 0x4355434b4f4f3031ull); // "CUCKOO01"
+	TagKey = mix64(Seed + 0x5441475354414731ull); // "TAGSTAG1"
+}
+
+uint64_t CuckooLayout::slot(uint64_t key, uint32_t h) const
+{
+	return mix64(key ^ HashKeys[h]) >> (64 - LogN);
+}
+
+uint64_t CuckooLayout::tag(uint64_t key) const
+{
+	return mix64(key ^ TagKey);
+}
+
+bool CuckooLayout::build(uint64_t *DB, const uint64_t *Keys, const uint64_t *Values, uint64_t Count) const
+{
+#ifdef SimLargeServer
+	assert(!"The simulated large server does not store every entry");
+#endif
+	uint64_t N = (uint64_t) 1 << LogN;
+	uint32_t B = EntrySize / 8;
+	uint32_t VW = valueWords();
+	if (Count > N)
+		return false;
+
+	// Random walk insertion: a key takes a free candidate slot if it has one, otherwise it evicts the key in a random candidate slot,
+	// which then looks for a slot of its own
+	vector<uint64_t> Owner(N, 0); // 1 + index of the key in each slot, 0 if the slot is empty
+	mt19937_64 gen(Seed);
+	for (uint64_t i = 0; i < Count; i++){
+		assert(tag(Keys[i]) != 0);
+		uint64_t cur = i + 1;
+		uint64_t prevSlot = N;
+		for (uint32_t kick = 0; cur && kick < MAX_KICKS; kick++){
+			for (uint32_t h = 0; h < KEY_HASHES; h++){
+				uint64_t s = slot(Keys[cur - 1], h);
+				if (!Owner[s]){
+					Owner[s] = cur;
+					cur = 0;
+					break;
+				}
+			}
+			if (!cur)
+				break;
+			// Evict from a random candidate slot other than the one this key was just evicted from, so it does not evict the key that evicted it
+			uint64_t candidates[KEY_HASHES];
+			uint32_t n = 0;
+			for (uint32_t h = 0; h < KEY_HASHES; h++){
+				uint64_t s = slot(Keys[cur - 1], h);
+				if (s != prevSlot && find(candidates, candidates + n, s) == candidates + n)
+					candidates[n++] = s;
+			}
+			if (!n)	// Every candidate is prevSlot
+				return false;
+			uint64_t s = candidates[gen() % n];
+			swap(Owner[s], cur);
+			prevSlot = s;
+		}
+		if (cur)
+			return false;
+	}
+
+	memset(DB, 0, N * EntrySize);
+	for (uint64_t s = 0; s < N; s++){
+		if (!Owner[s])
+			continue;
+		uint64_t k = Owner[s] - 1;
+		DB[s * B] = tag(Keys[k]);
+		memcpy(DB + s * B + 1, Values + k * VW, VW * 8);
+	}
+	return true;
+}
+
+bool initKeywordDatabase(uint64_t **DB, CuckooLayout &layout, const uint64_t *Keys, const uint64_t *Values, uint64_t Count)
+{
+	*DB = new uint64_t [databaseWords(layout.logN(), layout.entrySize())];
+	for (uint32_t attempt = 0; attempt < 8; attempt++){
+		CuckooLayout l(layout.logN(), layout.entrySize(), layout.seed() + attempt);
+		if (l.build(*DB, Keys, Values, Count)){
+			layout = l;
+			return true;
+		}
+	}
+	delete [] *DB;
+	*DB = nullptr;
+	return false;
+}
+
+KeywordClient::KeywordClient(const CuckooLayout &layout) : layout(layout), B(layout.entrySize() / 8), Slots(KEY_HASHES * B) {}
+
+bool KeywordClient::Lookup(OneSVClient &client, OneSVServer &server, uint64_t key, uint64_t *value)
+{
+	for (uint32_t h = 0; h < KEY_HASHES; h++)
+		client.Online(server, layout.slot(key, h), Slots.data() + h * B);
+	return Match(key, value);
+}
+
+bool KeywordClient::Lookup(TwoSVClient &client, TwoSVServer &online_server, TwoSVServer &offline_server, uint64_t key, uint64_t *value)
+{
+	for (uint32_t h = 0; h < KEY_HASHES; h++)
+		client.Online(online_server, offline_server, layout.slot(key, h), Slots.data() + h * B);
+	return Match(key, value);
+}
+
+bool KeywordClient::Match(uint64_t key, uint64_t *value)
+{
+	uint64_t t = layout.tag(key);
+	for (uint32_t h = 0; h < KEY_HASHES; h++){
+		if (Slots[h * B] == t){
+			memcpy(value, Slots.data() + h * B + 1, layout.valueWords() * 8);
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,111 @@
+#include <cassert>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+#include "loadgen.h"
+
+QueryStream::QueryStream(Dist dist, uint32_t LogN, double ZipfS, string TraceFile, uint64_t seed):
+ dist(dist), LogN(LogN), N((uint64_t) 1 << LogN), count(0), gen(seed), s(ZipfS) {
+	if (dist == Trace) {
+		ifstream in(TraceFile);
+		uint64_t index;
+		while (in >> index)
+			trace.push_back(index & (N - 1));
+		if (trace.empty()) {
+			cout << "Trace file " << TraceFile << " has no queries" << endl;
+			exit(1);
+		}
+	}
+	if (dist == Zipf) {
+		assert(s > 0);
+		hIntegralX1 = hIntegral(1.5) - 1;
+		hIntegralN = hIntegral(N + 0.5);
+		sThreshold = 2 - hIntegralInverse(hIntegral(2.5) - h(2));
+	}
+}
+
+uint64_t QueryStream::next() {
+	uint64_t i = count++;
+	switch (dist) {
+		case Diagonal: {
+			uint64_t part = i % ((uint64_t) 1 << LogN / 2);
+			uint64_t offset = i % ((uint64_t) 1 << LogN / 2);
+			return (part << (LogN / 2)) + offset;
+		}
+		case Uniform:
+			return gen() & (N - 1);
+		case Zipf:
+			// Scatter ranks over the database with an odd multiplier, a bijection mod N.
+			return ((sampleZipf() - 1) * 0x9E3779B1ull) & (N - 1);
+		case Trace:
+			return trace[i % trace.size()];
+	}
+	return 0;
+}
+
+bool QueryStream::parseDist(const string &name, Dist &dist) {
+	if (name == "diagonal") dist = Diagonal;
+	else if (name == "uniform") dist = Uniform;
+	else if (name == "zipf") dist = Zipf;
+	else if (name == "trace") dist = Trace;
+	else return false;
+	return true;
+}
+
+string QueryStream::distName(Dist dist) {
+	const char *names[] = {"diagonal", "uniform", "zipf", "trace"};
+	return names[dist];
+}
+
+// log1p(x) / x and expm1(x) / x, with Taylor expansions near 0.
+static double helper1(double x) {
+	return fabs(x) > 1e-8 ? log1p(x) / x : 1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x));
+}
+static double helper2(double x) {
+	return fabs(x) > 1e-8 ? expm1(x) / x : 1 + x * 0.5 * (1 + x / 3 * (1 + 0.25 * x));
+}
+
+double QueryStream::h(double x) {
+	return exp(-s * log(x));
+}
+
+double QueryStream::hIntegral(double x) {
+	double logX = log(x);
+	return helper2((1 - s) * logX) * logX;
+}
+
+double QueryStream::hIntegralInverse(double x) {
+	double t = max(x * (1 - s), -1.0);
+	return exp(helper1(t) * x);
+}
+
+// Returns a rank in [1, N], rank k being drawn with probability proportional to 1 / k^s.
+uint64_t QueryStream::sampleZipf() {
+	uniform_real_distribution<double> unit(0, 1);
+	while (true) {
+		double u = hIntegralN + unit(gen) * (hIntegralX1 - hIntegralN);
+		double x = hIntegralInverse(u);
+		double k = floor(x + 0.5);
+		k = min(max(k, 1.0), (double) N);
+		if (k - x <= sThreshold || u >= hIntegral(k + 0.5) - h(k))
+			return (uint64_t) k;
+	}
+}
+
+ArrivalProcess::ArrivalProcess(double Rate, uint64_t seed): Rate(Rate), started(false), gen(seed), gap(Rate > 0 ? Rate : 1) {}
+
+chrono::steady_clock::time_point ArrivalProcess::wait() {
+	auto now = chrono::steady_clock::now();
+	if (Rate <= 0)
+		return now;
+	if (!started) {
+		nextArrival = now;
+		started = true;
+	}
+	nextArrival += chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(gap(gen)));
+	if (nextArrival > now)
+		this_thread::sleep_until(nextArrival);
+	return nextArrival;
+}
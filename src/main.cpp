@@ -1,48 +1,277 @@
 #include <fstream>
+#include <sstream>
 #include <chrono>
 #include <vector>
 #include <type_traits>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <cmath>
+#include <thread>
+#include <atomic>
+#include <memory>
 
 #include "client.h"
 #include "server.h"
 #include "utils.h"
+#include "loadgen.h"
+#include "metrics.h"
+#include "perfcounters.h"
 
 using namespace std;
 
 uint64_t *DB;
+uint64_t DBWords; // Capacity of DB in uint64s, kept across the runs of a sweep
+uint64_t DBLog2Size, DBEntrySize, DBSeed; // Database DB currently holds
 
 struct Options {
 	uint64_t Log2DBSize;
 	uint64_t EntrySize;
 	string OutputFile;
 	bool OneSV;
+	string DiskFile; // If set, the servers read the database from this file
+	uint32_t CachedParts; // Partitions of the disk-backed database pinned in memory
+	bool DirectIO;
+	QueryStream::Dist Dist; // Distribution of query indices
+	double ZipfS; // Zipf exponent
+	string TraceFile; // Query indices to replay for the trace distribution
+	double Rate; // Open-loop arrival rate in queries per second, 0 for closed loop
+	uint64_t NumQueries; // Number of online queries, 0 for PartSize
+	uint32_t Threads; // Concurrent online queries
+	uint32_t Precompute; // Hints whose rows are expanded ahead of time in the background, 0 for none
+	string HistogramFile; // If set, per-stage latency histograms are appended to this file
+	string MetricsFile; // If set, protocol metrics are written to this file
+	bool Perf; // Capture hardware performance counters per protocol phase
+	uint64_t Seed; // Seed of the generated database
+	bool Lazy; // Recompute entries from their index instead of storing the database
+	bool Verify; // Check every query result against the generated database
+	bool Wide; // Use the wide index layout even if the database has at most 2^31 entries
+	uint32_t LogPartNum; // log2 of the number of partitions, 0 for Log2DBSize / 2
+	uint32_t Lambda; // Correctness parameter, 0 for LAMBDA
+	bool Tune; // Pick the partitioning with the lowest cost per query instead of running once
+	uint64_t MemoryBudget; // Client storage limit of the tuner in bytes, 0 for no limit
+	bool Sweep; // Run every configuration of the grid below in this process
+	vector<uint64_t> SweepVariants; // 1 for one server, 0 for two server
+	vector<uint64_t> SweepLog2DBSizes;
+	vector<uint64_t> SweepEntrySizes;
+	uint32_t Reps; // Measured runs per sweep configuration
+	uint32_t Warmup; // Discarded runs per sweep configuration
+};
+
+#define MAX_INVALID_RATE 0.01 // Largest fraction of invalid hints of a partitioning the tune mode picks
+
+// Measurements of one test_pir run that a sweep aggregates.
+struct RunSummary {
+	uint64_t NumQueries;
+	double OfflineTime; // s
+	double OnlineTime; // ms per query
+	double AmortizedTime; // ms per query, 0 for the two server variant
+	double TotalP50; // ms
+	double TotalP99; // ms
+	double InvalidRate; // Fraction of the hints without a cutoff after the offline phase
 };
 
 void print_usage(){
 	cout << "Usage:	" << endl
 				<< "\t./s3pir --one-server <Log2 DB Size> <Entry Size> <Output File>" << endl
 				<< "\t./s3pir --two-server <Log2 DB Size> <Entry Size> <Output File>" << endl
-				<< "Runs the s3pir protocol on a database with <Log2 DB Size> number of entries and entries of <Entry Size> bytes with either the one server or two server variant. If <Output File> doesn't exist, creates <Output File> and adds profiling data to the file in csv format. Otherwise append it to the end of the file.  " << endl << endl;
+				<< "\t./s3pir --sweep <Variants> <Log2 DB Sizes> <Entry Sizes> <Output File>" << endl
+				<< "\t./s3pir --tune <Variant> <Log2 DB Size> <Entry Size> <Output File>" << endl
+				<< "Runs the s3pir protocol on a database with <Log2 DB Size> number of entries and entries of <Entry Size> bytes with either the one server or two server variant. If <Output File> doesn't exist, creates <Output File> and adds profiling data to the file in csv format. Otherwise append it to the end of the file.  " << endl << endl
+				<< "The sweep mode runs every combination of the comma separated <Variants> (one, two), <Log2 DB Sizes> and <Entry Sizes> in a single process, reusing the database buffer. Lists may contain ranges such as 20-28:2. Each combination is run --warmup times, then --reps times, and its mean and 95% confidence interval are written to <Output File>." << endl << endl
+				<< "The tune mode runs the <Variant> (one or two) with 2^(<Log2 DB Size> / 2 - 3) to 2^(<Log2 DB Size> / 2 + 3) partitions, at least 2^" << MIN_LOG_PART_NUM << ", skipping those whose client storage exceeds --memory. Each partitioning is run like a sweep configuration and written to <Output File>. The one with the lowest amortized time per query (online time for the two server variant) is reported, among those with at most " << MAX_INVALID_RATE * 100 << "% invalid hints." << endl << endl
+				<< "Options:" << endl
+				<< "\t--disk <DB File>\tServe the database from <DB File> on disk. The file is generated if it does not have the right size." << endl
+				<< "\t--cache-parts <n>\tPin the first <n> partitions of the disk-backed database in memory." << endl
+				<< "\t--direct\t\tOpen the disk-backed database with O_DIRECT." << endl
+				<< "\t--dist <name>\t\tQuery distribution: diagonal (default), uniform, zipf or trace." << endl
+				<< "\t--zipf-s <s>\t\tZipf exponent (default 0.99)." << endl
+				<< "\t--trace <file>\t\tReplay the query indices in <file>, one per line. Implies --dist trace." << endl
+				<< "\t--rate <qps>\t\tIssue queries open-loop with Poisson arrivals at <qps> queries per second. Latency includes queueing delay." << endl
+				<< "\t--queries <n>\t\tNumber of online queries (default PartSize). The one server variant supports up to M/2 minus invalid backup hints." << endl
+				<< "\t--threads <n>\t\tRun the online queries from <n> threads sharing one client. Not supported with --disk, --rate or --perf." << endl
+				<< "\t--precompute <n>\tExpand the PRF rows of the last <n> replenished hints in a background thread while the CPU is idle." << endl
+				<< "\t--histogram <file>\tAppend per-stage latency histograms to <file> in csv format." << endl
+				<< "\t--perf\t\t\tAdd hardware performance counters of each protocol phase to the csv. Left empty (-) where perf_event_open is not available." << endl
+				<< "\t--seed <n>\t\tSeed of the generated database (default 1)." << endl
+				<< "\t--lazy\t\t\tDo not store the database, the servers recompute every entry they read from its index." << endl
+				<< "\t--verify\t\tCheck every query result against the generated database." << endl
+				<< "\t--wide\t\t\tUse the wide index layout of databases larger than 2^31 entries for any size." << endl
+				<< "\t--log-parts <n>\t\tSplit the database into 2^<n> partitions, <n> >= " << MIN_LOG_PART_NUM << " (default <Log2 DB Size> / 2)." << endl
+				<< "\t--lambda <n>\t\tCorrectness parameter, the client keeps <n> * PartSize hints (default " << LAMBDA << ")." << endl
+				<< "\t--memory <MiB>\t\tClient storage budget of the tune mode." << endl
+				<< "\t--reps <n>\t\tMeasured runs per sweep configuration (default 3)." << endl
+				<< "\t--warmup <n>\t\tDiscarded runs per sweep configuration (default 1)." << endl
+				<< "\t--metrics <file>\tWrite protocol metrics to <file>, as JSON if it ends in .json and in the Prometheus text format otherwise." << endl << endl;
+}
+
+// Parses a comma separated list of numbers and ranges lo-hi or lo-hi:step.
+vector<uint64_t> parse_list(string list)
+{
+	vector<uint64_t> values;
+	stringstream items(list);
+	string item;
+	while (getline(items, item, ',')){
+		size_t dash = item.find('-');
+		if (dash == string::npos){
+			values.push_back(stoull(item));
+			continue;
+		}
+		size_t colon = item.find(':');
+		uint64_t lo = stoull(item.substr(0, dash));
+		uint64_t hi = stoull(item.substr(dash + 1, colon - dash - 1));
+		uint64_t step = colon == string::npos ? 1 : stoull(item.substr(colon + 1));
+		if (step == 0)
+			throw invalid_argument(item);
+		for (uint64_t v = lo; v <= hi; v += step)
+			values.push_back(v);
+	}
+	if (values.empty())
+		throw invalid_argument(list);
+	return values;
+}
+
+// Parses the value of an option that must be a positive 32-bit number, printing an error and exiting if it is not.
+uint32_t positive_option(const char *name, const char *value)
+{
+	long long v = stoll(value);
+	if (v <= 0 || v > UINT32_MAX){
+		cout << name << " must be a positive number" << endl;
+		exit(1);
+	}
+	return v;
+}
+
+// Returns why the partitioning and lambda of the options do not work for a database of 2^LogN entries, or an empty string if they do.
+string geometry_error(const Options &options, uint64_t LogN)
+{
+	if (LogN < 2 || LogN > MAX_LOG_N)
+		return "<Log2 DB Size> must be between 2 and " + to_string(MAX_LOG_N);
+	if (options.LogPartNum && (options.LogPartNum < MIN_LOG_PART_NUM || options.LogPartNum >= LogN || options.LogPartNum > 31))
+		return "--log-parts must be between " + to_string(MIN_LOG_PART_NUM) + " and the smaller of <Log2 DB Size> - 1 and 31";
+	if (LogN - (options.LogPartNum ? options.LogPartNum : LogN / 2) > 31)
+		return "Partitions hold at most 2^31 entries, use --log-parts " + to_string(LogN - 31) + " or more";
+	Geometry geo = Geometry(options.LogPartNum, options.Lambda, options.Wide).resolve(LogN);
+	// The one server client numbers its hints and backup hints with 32 bits
+	uint64_t M = (uint64_t) geo.Lambda << (LogN - geo.LogPartNum);
+	if (M + M / 2 > UINT32_MAX)
+		return "lambda * PartSize = " + to_string(M) + " hints do not fit 32-bit hint numbers, lower --lambda or raise --log-parts";
+	return "";
 }
 
 Options parse_options (int argc, char * argv[])
 {
-	Options options{false, false};
+	Options options{};
+	options.Dist = QueryStream::Diagonal;
+	options.ZipfS = 0.99;
+	options.Reps = 3;
+	options.Seed = 1;
+	options.Warmup = 1;
+	options.Threads = 1;
 
 	try{
-		if (argc == 5){
+		if (argc >= 5){
+			int first_option = 5;
 			if (strcmp(argv[1], "--two-server") == 0){
 				options.OneSV = 0;
 			} else if (strcmp(argv[1], "--one-server") == 0){
 				options.OneSV = 1;
+			} else if (strcmp(argv[1], "--sweep") == 0 && argc >= 6){
+				options.Sweep = true;
+				stringstream variants(argv[2]);
+				string variant;
+				while (getline(variants, variant, ',')){
+					if (variant != "one" && variant != "two")
+						throw invalid_argument(variant);
+					options.SweepVariants.push_back(variant == "one");
+				}
+				if (options.SweepVariants.empty())
+					throw invalid_argument(argv[2]);
+				options.SweepLog2DBSizes = parse_list(argv[3]);
+				options.SweepEntrySizes = parse_list(argv[4]);
+				options.OutputFile = argv[5];
+				first_option = 6;
+			} else if (strcmp(argv[1], "--tune") == 0 && argc >= 6){
+				options.Tune = true;
+				if (strcmp(argv[2], "one") != 0 && strcmp(argv[2], "two") != 0)
+					throw invalid_argument(argv[2]);
+				options.OneSV = strcmp(argv[2], "one") == 0;
+				options.Log2DBSize = stoi(argv[3]);
+				options.EntrySize = stoi(argv[4]);
+				options.OutputFile = argv[5];
+				first_option = 6;
 			} else {
 				print_usage();
 				exit(0);
 			}
-			options.Log2DBSize = stoi(argv[2]);
-			options.EntrySize = stoi(argv[3]);
-			options.OutputFile = argv[4];
+			if (!options.Sweep && !options.Tune){
+				options.Log2DBSize = stoi(argv[2]);
+				options.EntrySize = stoi(argv[3]);
+				options.OutputFile = argv[4];
+			}
+			for (int i = first_option; i < argc; i++){
+				if (strcmp(argv[i], "--disk") == 0 && i + 1 < argc){
+					options.DiskFile = argv[++i];
+				} else if (strcmp(argv[i], "--cache-parts") == 0 && i + 1 < argc){
+					options.CachedParts = stoi(argv[++i]);
+				} else if (strcmp(argv[i], "--direct") == 0){
+					options.DirectIO = true;
+				} else if (strcmp(argv[i], "--dist") == 0 && i + 1 < argc && QueryStream::parseDist(argv[i + 1], options.Dist)){
+					i++;
+				} else if (strcmp(argv[i], "--zipf-s") == 0 && i + 1 < argc){
+					options.ZipfS = stod(argv[++i]);
+				} else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc){
+					options.TraceFile = argv[++i];
+					options.Dist = QueryStream::Trace;
+				} else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc){
+					options.Rate = stod(argv[++i]);
+				} else if (strcmp(argv[i], "--queries") == 0 && i + 1 < argc){
+					options.NumQueries = stoull(argv[++i]);
+				} else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc){
+					options.Threads = max(1, stoi(argv[++i]));
+				} else if (strcmp(argv[i], "--precompute") == 0 && i + 1 < argc){
+					options.Precompute = stoul(argv[++i]);
+				} else if (strcmp(argv[i], "--histogram") == 0 && i + 1 < argc){
+					options.HistogramFile = argv[++i];
+				} else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc){
+					options.Seed = stoull(argv[++i]);
+				} else if (strcmp(argv[i], "--lazy") == 0){
+					options.Lazy = true;
+				} else if (strcmp(argv[i], "--verify") == 0){
+					options.Verify = true;
+				} else if (strcmp(argv[i], "--wide") == 0){
+					options.Wide = true;
+				} else if (strcmp(argv[i], "--log-parts") == 0 && i + 1 < argc){
+					options.LogPartNum = positive_option("--log-parts", argv[++i]);
+				} else if (strcmp(argv[i], "--lambda") == 0 && i + 1 < argc){
+					options.Lambda = positive_option("--lambda", argv[++i]);
+				} else if (strcmp(argv[i], "--memory") == 0 && i + 1 < argc){
+					options.MemoryBudget = stoull(argv[++i]) << 20;
+				} else if (strcmp(argv[i], "--reps") == 0 && i + 1 < argc){
+					options.Reps = max(1, stoi(argv[++i]));
+				} else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc){
+					options.Warmup = stoi(argv[++i]);
+				} else if (strcmp(argv[i], "--perf") == 0){
+					options.Perf = true;
+				} else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc){
+					options.MetricsFile = argv[++i];
+				} else {
+					print_usage();
+					exit(0);
+				}
+			}
+			if (options.Threads > 1 && (!options.DiskFile.empty() || options.Rate > 0 || options.Perf)){
+				cout << "--threads cannot be combined with --disk, --rate or --perf" << endl;
+				exit(1);
+			}
+			// The tune mode checks each partitioning it tries
+			if (!options.Tune)
+				for (uint64_t log_db_size : options.Sweep ? options.SweepLog2DBSizes : vector<uint64_t>{options.Log2DBSize}){
+					string error = geometry_error(options, log_db_size);
+					if (!error.empty()){
+						cout << error << endl;
+						exit(1);
+					}
+				}
 			return options;
 		} 
 		print_usage();
@@ -54,16 +283,86 @@ Options parse_options (int argc, char * argv[])
 }
 
 // Helper function since clients have different function signatures between variants
-inline void test_client_query(OneSVClient& client, OneSVServer& server, uint32_t & query, uint64_t * result){
+inline void test_client_query(OneSVClient& client, OneSVServer& server, uint64_t & query, uint64_t * result){
 	client.Online(server, query, result);
 }
-inline void test_client_query(TwoSVClient& client, TwoSVServer& server, uint32_t & query, uint64_t * result){
+inline void test_client_query(TwoSVClient& client, TwoSVServer& server, uint64_t & query, uint64_t * result){
 	client.Online(server, server, query, result);
 }
+inline void test_client_query(OneSVClient& client, OneSVServer& server, uint64_t & query, uint64_t * result, OneSVClient::Context &ctx){
+	client.Online(server, query, result, ctx);
+}
+inline void test_client_query(TwoSVClient& client, TwoSVServer& server, uint64_t & query, uint64_t * result, TwoSVClient::Context &ctx){
+	client.Online(server, server, query, result, ctx);
+}
 
+// Returns a disk-backed database for the options, writing the generated database to the file first if it is missing or has the wrong size.
+DiskDB * open_disk_db(const Options &options, DBGenerator &gen)
+{
+	struct stat st;
+	uint64_t expected = options.EntrySize << options.Log2DBSize;
+	if (stat(options.DiskFile.c_str(), &st) != 0 || (uint64_t) st.st_size != expected){
+		cout << "Writing database to " << options.DiskFile << endl;
+		DiskDB::writeFile(options.DiskFile, gen, options.Log2DBSize, options.EntrySize);
+	}
+	return new DiskDB(options.DiskFile, options.Log2DBSize, options.EntrySize, options.CachedParts, options.DirectIO, options.LogPartNum);
+}
+
+// Mem Bytes estimates the memory traffic as one cache line per last level cache miss.
+const char *PerfColumns[] = {"Cycles", "Instructions", "LLC Misses", "dTLB Misses", "Mem Bytes"};
+
+// Writes the counters of the offline phase and the per query counters of each online stage, or - for counters that were not captured.
+void write_perf_counters(const PerfCounters *perf, ostream &output_csv)
+{
+	for (int p = 0; p < PerfCounters::NumPhases; p++){
+		PerfCounters::Phase phase = (PerfCounters::Phase) p;
+		uint64_t n = perf ? perf->occurrences(phase) : 0;
+		if (perf && n)
+			cout << PerfCounters::phaseName(phase) << (p ? " per query:" : ":");
+		for (int c = 0; c < 5; c++){
+			PerfCounters::Event e = c == 4 ? PerfCounters::LLCMisses : (PerfCounters::Event) c;
+			if (!perf || !n || !perf->has(e)){
+				output_csv << ", -";
+				continue;
+			}
+			double value = (double) perf->total(phase, e) / (p ? n : 1);
+			if (c == 4)
+				value *= 64;
+			output_csv << ", " << value;
+			cout << " " << PerfColumns[c] << " " << value;
+		}
+		if (perf && n)
+			cout << endl;
+	}
+}
+
+// Makes DB hold the generated database of the configured size and seed. The buffer is reused if it is large enough and only refilled if the database changed.
+void prepare_database(const Options &options)
+{
+	uint64_t words = databaseWords(options.Log2DBSize, options.EntrySize);
+	if (words > DBWords){
+		delete [] DB;
+		DB = new uint64_t [words];
+		DBWords = words;
+		DBEntrySize = 0;
+	}
+	if (DBLog2Size == options.Log2DBSize && DBEntrySize == options.EntrySize && DBSeed == options.Seed)
+		return;
+	auto start = chrono::steady_clock::now();
+	fillDatabase(DB, options.Log2DBSize, options.EntrySize, options.Seed);
+	cout << "Generated database in " << chrono::duration<double>(chrono::steady_clock::now() - start).count() << " s" << endl;
+	DBLog2Size = options.Log2DBSize;
+	DBEntrySize = options.EntrySize;
+	DBSeed = options.Seed;
+}
+
+// Runs the offline phase and the online queries once and appends a row to output_csv. If summary is set, the measurements are also stored there.
 template<typename Client, typename Server>
-void test_pir(uint64_t kLogDBSize, uint64_t kEntrySize, ofstream &output_csv) 
+void test_pir(const Options &options, ostream &output_csv, RunSummary *summary = nullptr) 
 {
+	uint64_t kLogDBSize = options.Log2DBSize;
+	uint64_t kEntrySize = options.EntrySize;
+
 	if (is_same<Client, TwoSVClient>::value && is_same<Server, TwoSVServer>::value) {
 		cout << "== Two server variant ==" << endl; 
 		output_csv << "Two server, ";
@@ -71,76 +370,411 @@ void test_pir(uint64_t kLogDBSize, uint64_t kEntrySize, ofstream &output_csv)
 		cout << "== One server variant ==" << endl; 
 		output_csv << "One server, ";
 	}
+	Geometry geo = Geometry(options.LogPartNum, options.Lambda, options.Wide).resolve(kLogDBSize);
+	uint64_t PartSize = (uint64_t) 1 << (kLogDBSize - geo.LogPartNum);
 	cout << "LogDBSize: " << kLogDBSize << "\nEntrySize: " << kEntrySize << " bytes" << endl;
+	cout << "Partitions: 2^" << geo.LogPartNum << " of " << PartSize << " entries, lambda: " << geo.Lambda << (geo.Wide ? ", wide layout" : "") << endl;
 	output_csv << kLogDBSize << ", " << kEntrySize << ", ";
 
-	initDatabase(&DB, kLogDBSize, kEntrySize);
-	Client client(kLogDBSize, kEntrySize);
-  Server server(DB, kLogDBSize, kEntrySize);
+	DBGenerator gen(kEntrySize, options.Seed);
+	// A disk-backed database is written from gen, it is not kept in memory
+	if (!options.Lazy && options.DiskFile.empty())
+		prepare_database(options);
+	DiskDB *disk = nullptr;
+	if (!options.DiskFile.empty())
+		disk = open_disk_db(options, gen);
+	uint64_t *db = options.Lazy || disk ? nullptr : DB;
+	Client client(kLogDBSize, kEntrySize, geo);
+	if (options.Precompute)
+		client.enablePrecompute(options.Precompute);
+  Server server(db, kLogDBSize, kEntrySize, disk, options.Lazy ? &gen : nullptr, geo);
+	PerfCounters *perf = nullptr;
+	if (options.Perf){
+		perf = new PerfCounters();
+		if (perf->available())
+			client.Perf = perf;
+		else
+			cout << "Hardware performance counters are not available" << endl;
+	}
 
 	cout << "Running offline phase.." << endl;
 	auto start = chrono::high_resolution_clock::now();	
 	client.Offline(server);
 	auto end = chrono::high_resolution_clock::now();	
-	auto offline_time = chrono::duration_cast<chrono::milliseconds>(end - start);
+	auto offline_time = chrono::duration<double, milli>(end - start);
 	cout << "Offline: " << (double) offline_time.count() / 1000.0 << " s"<< endl;
+	double invalid_rate = client.invalidRate();
+
+	QueryStream queries(options.Dist, kLogDBSize, options.ZipfS, options.TraceFile);
+	ArrivalProcess arrivals(options.Rate);
+	LatencyStats total_latency, generate_latency, answer_latency, replenish_latency;
+	uint64_t service_ns = 0;
 
 	start = chrono::high_resolution_clock::now();	
 	uint64_t *result = new uint64_t [kEntrySize/8];
-	int num_queries = 1 << (kLogDBSize / 2 + kLogDBSize % 2); 	// Run PartitionSize queries, < half of backup hints
-	cout << "Running " << num_queries << " queries" << endl;
+	uint64_t num_queries = PartSize; 	// Run PartitionSize queries, < half of backup hints
+	if (options.NumQueries)
+		num_queries = options.NumQueries;
+	cout << "Running " << num_queries << " " << QueryStream::distName(options.Dist) << " queries";
+	if (options.Rate > 0)
+		cout << " at " << options.Rate << " queries/s";
+	if (options.Threads > 1)
+		cout << " from " << options.Threads << " threads";
+	cout << endl;
+	vector<uint64_t> verify_queries;
+	vector<uint64_t> verify_results;
 	int progress = 0;
-	int milestones = num_queries/5;
-	for (uint64_t i = 0; i < num_queries; i++)
+	uint64_t milestones = max(num_queries/5, (uint64_t) 1);
+	if (options.Threads > 1){
+		// The queries are drawn up front and handed out through a shared counter. Each thread has its own query context, and its own
+		// server instance (and entry generator) since the servers keep scratch state per call.
+		vector<uint64_t> query_list(num_queries);
+		for (uint64_t &query : query_list)
+			query = queries.next();
+		if (options.Verify){
+			verify_queries = query_list;
+			verify_results.resize(num_queries * (kEntrySize/8));
+		}
+		atomic<uint64_t> next(0);
+		vector<LatencyStats> thread_latency(4 * options.Threads);
+		vector<thread> workers;
+		for (uint32_t t = 0; t < options.Threads; t++)
+			workers.emplace_back([&, t](){
+				DBGenerator thread_gen(kEntrySize, options.Seed);
+				Server thread_server(db, kLogDBSize, kEntrySize, nullptr, options.Lazy ? &thread_gen : nullptr, geo);
+				unique_ptr<typename Client::Context> ctx(client.newContext());
+				vector<uint64_t> entry(kEntrySize/8);
+				LatencyStats *stats = &thread_latency[4 * t];
+				for (uint64_t i = next++; i < num_queries; i = next++){
+					auto issued = chrono::steady_clock::now();
+					test_client_query(client, thread_server, query_list[i], entry.data(), *ctx);
+					auto done = chrono::steady_clock::now();
+					stats[0].add(chrono::duration_cast<chrono::nanoseconds>(done - issued).count());
+					stats[1].add(ctx->Timings.Generate);
+					stats[2].add(ctx->Timings.Answer);
+					stats[3].add(ctx->Timings.Replenish);
+					if (options.Verify)
+						memcpy(verify_results.data() + i * (kEntrySize/8), entry.data(), kEntrySize);
+				}
+			});
+		for (thread &worker : workers)
+			worker.join();
+		for (uint32_t t = 0; t < options.Threads; t++){
+			total_latency.merge(thread_latency[4 * t]);
+			generate_latency.merge(thread_latency[4 * t + 1]);
+			answer_latency.merge(thread_latency[4 * t + 2]);
+			replenish_latency.merge(thread_latency[4 * t + 3]);
+		}
+	}
+	for (uint64_t i = 0; options.Threads == 1 && i < num_queries; i++)
 	{
 		if (i % milestones == 0){
 			cout << "Completed: " << progress * 20 << "%" << endl;
 			progress++;
 		} 
 		
-		uint16_t part = i % (1 << kLogDBSize / 2);
-		uint16_t offset = i % (1 << kLogDBSize / 2);
-		uint32_t query = (part << (kLogDBSize / 2)) + offset;
-		
+		uint64_t query = queries.next();
+		auto arrival = arrivals.wait();
+		auto issued = chrono::steady_clock::now();
 		test_client_query(client, server, query, result);
+		auto done = chrono::steady_clock::now();
+
+		total_latency.add(chrono::duration_cast<chrono::nanoseconds>(done - arrival).count());
+		service_ns += chrono::duration_cast<chrono::nanoseconds>(done - issued).count();
+		generate_latency.add(client.LastTimings.Generate);
+		answer_latency.add(client.LastTimings.Answer);
+		replenish_latency.add(client.LastTimings.Replenish);
+		if (options.Verify){
+			verify_queries.push_back(query);
+			verify_results.insert(verify_results.end(), result, result + kEntrySize/8);
+		}
 	}
 	end = chrono::high_resolution_clock::now();	
-	auto total_online_time = chrono::duration_cast<chrono::milliseconds>( (end - start) );
-	double online_time = ((double) total_online_time.count()) / num_queries;
+	auto total_online_time = chrono::duration<double, milli>(end - start);
+
+	if (options.Verify){
+		// The servers may reduce query modulo N, and the simulated large server stores entry i / EntrySize at index i
+		uint64_t failed = 0;
+		for (uint64_t i = 0; i < verify_queries.size(); i++){
+			uint64_t index = verify_queries[i] % (1ull << kLogDBSize);
+#ifdef SimLargeServer
+			if (!options.Lazy && !disk)
+				index /= kEntrySize;
+#endif
+			gen.entry(index, result);
+			if (memcmp(result, verify_results.data() + i * (kEntrySize/8), kEntrySize) != 0){
+				if (!failed)
+					cout << "Query " << verify_queries[i] << " returned a wrong entry" << endl;
+				failed++;
+			}
+		}
+		cout << "Verified " << verify_queries.size() << " queries, " << failed << " failed" << endl;
+		assert(failed == 0);
+	}
+	// Open-loop runs spend time waiting for arrivals, so the cost per query is the time actually spent serving queries.
+	double online_time = options.Rate > 0 ? service_ns / 1e6 / num_queries : ((double) total_online_time.count()) / num_queries;
 
 	cout << "Ran " << num_queries << " queries" << endl;
 	cout << "Online: " << total_online_time.count() << " ms"<< endl;
 	cout << "Cost Per Query: " << online_time << " ms" << endl;
+	if (client.Precompute)
+		cout << "Precomputed hint rows used: " << client.Precompute->Hits << " of " << client.Precompute->Hits + client.Precompute->Misses << " queries" << endl;
+	if (options.Threads > 1)
+		cout << "Throughput: " << num_queries / (total_online_time.count() / 1000.0) << " queries/s" << endl;
 
 	output_csv << num_queries << ", " << (double) offline_time.count() / 1000.0 << ", " <<  online_time;
+	double amortized_time = 0;
 	if (is_same<Client, TwoSVClient>::value && is_same<Server, TwoSVServer>::value) {
 		output_csv << ", -" ;
 	}  else if (is_same<Client, OneSVClient>::value && is_same<Server, OneSVServer>::value) {
-		double amortized_compute_time_per_query = ((double) offline_time.count()) / (0.5 * LAMBDA * (1 << (kLogDBSize / 2))) + online_time;
+		// The offline phase is amortized over the M/2 backup hints
+		double amortized_compute_time_per_query = ((double) offline_time.count()) / (0.5 * geo.Lambda * PartSize) + online_time;
 		cout << "Amortized compute time per query: " << amortized_compute_time_per_query  << " ms" << endl; 
+		amortized_time = amortized_compute_time_per_query;
 		output_csv << ", " << amortized_compute_time_per_query;
 	}
+
+	// Latency percentiles in ms, end to end and per stage
+	output_csv << ", " << QueryStream::distName(options.Dist) << ", " << options.Rate;
+	LatencyStats *stages[] = {&total_latency, &generate_latency, &answer_latency, &replenish_latency};
+	const char *stage_names[] = {"Total", "Generate", "Answer", "Replenish"};
+	for (uint32_t s = 0; s < 4; s++){
+		cout << stage_names[s] << " latency p50/p90/p99/p999: ";
+		double pcts[] = {50, 90, 99, 99.9};
+		for (uint32_t p = 0; p < 4; p++){
+			double ms = stages[s]->percentile(pcts[p]) / 1e6;
+			output_csv << ", " << ms;
+			cout << ms << (p < 3 ? " / " : " ms\n");
+		}
+	}
+	write_perf_counters(client.Perf, output_csv);
 	output_csv << endl;
+	delete perf;
+	delete [] result;
+
+	if (summary){
+		summary->NumQueries = num_queries;
+		summary->OfflineTime = (double) offline_time.count() / 1000.0;
+		summary->OnlineTime = online_time;
+		summary->AmortizedTime = amortized_time;
+		summary->TotalP50 = total_latency.percentile(50) / 1e6;
+		summary->TotalP99 = total_latency.percentile(99) / 1e6;
+		summary->InvalidRate = invalid_rate;
+	}
+
+	if (!options.HistogramFile.empty()){
+		bool new_file = access(options.HistogramFile.c_str(), F_OK) == -1;
+		ofstream histogram(options.HistogramFile, ofstream::out | ofstream::app);
+		if (new_file)
+			histogram << "Variant, Log2 DBSize, EntrySize(Bytes), Dist, Rate (qps), Stage, Lower (us), Upper (us), Count" << endl;
+		string variant = is_same<Client, OneSVClient>::value ? "One server" : "Two server";
+		for (uint32_t s = 0; s < 4; s++){
+			ostringstream prefix;
+			prefix << variant << ", " << kLogDBSize << ", " << kEntrySize << ", " << QueryStream::distName(options.Dist) << ", " << options.Rate << ", " << stage_names[s] << ", ";
+			stages[s]->writeHistogram(histogram, prefix.str());
+		}
+	}
+
+	if (!options.MetricsFile.empty()){
+		const string &f = options.MetricsFile;
+		bool json = f.size() >= 5 && f.compare(f.size() - 5, 5, ".json") == 0;
+		ofstream metrics(f);
+		metrics << (json ? Metrics::json() : Metrics::prometheus());
+		cout << "Metrics written to " << f << endl;
+	}
+
+	if (disk){
+		cout << "Disk batches: " << disk->Latency.count() << ", disk reads: " << disk->DiskReads << ", cache hits: " << disk->CacheHits << endl;
+		cout << "Disk batch latency p50/p90/p99/max: " 
+				 << disk->Latency.percentile(50) / 1000.0 << " / " << disk->Latency.percentile(90) / 1000.0 << " / "
+				 << disk->Latency.percentile(99) / 1000.0 << " / " << disk->Latency.percentile(100) / 1000.0 << " us" << endl;
+		delete disk;
+	}
 	cout << endl;
 }
 
+// Computes the mean of values and the half width of its 95% confidence interval, using Student's t distribution.
+void mean_ci95(const vector<double> &values, double &mean, double &ci)
+{
+	// Two-sided 97.5% quantiles of the t distribution for 1 to 30 degrees of freedom
+	const double t[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+											2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+											2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+	size_t n = values.size();
+	mean = 0;
+	for (double v : values)
+		mean += v;
+	mean /= n;
+	ci = 0;
+	if (n < 2)
+		return;
+	double sq = 0;
+	for (double v : values)
+		sq += (v - mean) * (v - mean);
+	ci = (n - 1 <= 30 ? t[n - 2] : 1.96) * sqrt(sq / (n - 1) / n);
+}
+
+// Columns of the sweep and tune outputs, the mean and 95% confidence interval of each over the measured runs.
+const char *SummaryColumns[] = {"Offline Time (s)", "Online Time (ms)", "Amortized Compute Time Per Query (ms)", "Total p50 (ms)", "Total p99 (ms)"};
+
+// Runs the configuration of options --warmup times, then --reps times. Appends the mean and confidence interval of each summary column 
+// over the measured runs to csv and returns the means in means. label names the configuration in the printed summary.
+void run_reps(const Options &options, const string &label, ostream &csv, RunSummary &summary, double means[5])
+{
+	vector<double> columns[5];
+	for (uint32_t rep = 0; rep < options.Warmup + options.Reps; rep++){
+		cout << (rep < options.Warmup ? "Warmup run " : "Run ") << (rep < options.Warmup ? rep : rep - options.Warmup) + 1 << endl;
+		ostringstream row; // Rows of single runs are not kept
+		if (options.OneSV)
+			test_pir<OneSVClient, OneSVServer> (options, row, &summary);
+		else
+			test_pir<TwoSVClient, TwoSVServer> (options, row, &summary);
+		if (rep < options.Warmup)
+			continue;
+		columns[0].push_back(summary.OfflineTime);
+		columns[1].push_back(summary.OnlineTime);
+		columns[2].push_back(summary.AmortizedTime);
+		columns[3].push_back(summary.TotalP50);
+		columns[4].push_back(summary.TotalP99);
+	}
+
+	cout << "== " << label << " ==" << endl;
+	const char *names[] = {"Offline time", "Online time", "Amortized time", "Total p50", "Total p99"};
+	for (uint32_t c = 0; c < 5; c++){
+		double ci;
+		mean_ci95(columns[c], means[c], ci);
+		if (c == 2 && !options.OneSV){
+			csv << ", -, -";
+			continue;
+		}
+		csv << ", " << means[c] << ", " << ci;
+		cout << names[c] << ": " << means[c] << " +/- " << ci << (c ? " ms" : " s") << endl;
+	}
+	csv << endl;
+}
+
+// Runs every configuration of the sweep grid in this process and appends one row per configuration to the output file.
+void run_sweep(Options options)
+{
+	bool new_file = access(options.OutputFile.c_str(), F_OK) == -1;
+	ofstream sweep_csv(options.OutputFile, ofstream::out | ofstream::app);
+	if (new_file){
+		sweep_csv << "Variant, Log2 DBSize, EntrySize(Bytes), NumQueries, Dist, Reps";
+		for (const char *column : SummaryColumns)
+			sweep_csv << ", " << column << " Mean, " << column << " CI95";
+		sweep_csv << endl;
+	}
+
+	for (uint64_t variant : options.SweepVariants)
+		for (uint64_t log_db_size : options.SweepLog2DBSizes)
+			for (uint64_t entry_size : options.SweepEntrySizes){
+				options.OneSV = variant;
+				options.Log2DBSize = log_db_size;
+				options.EntrySize = entry_size;
+				RunSummary summary;
+				ostringstream label, means; // NumQueries is only known after the runs
+				label << (options.OneSV ? "One server" : "Two server") << ", " << log_db_size << ", " << entry_size;
+				double mean[5];
+				run_reps(options, label.str(), means, summary, mean);
+				sweep_csv << (options.OneSV ? "One server" : "Two server") << ", " << log_db_size << ", " << entry_size << ", " << summary.NumQueries
+									<< ", " << QueryStream::distName(options.Dist) << ", " << options.Reps << means.str();
+				cout << endl;
+			}
+}
+
+/* 
+Runs the variant with 2^(LogN/2 - 3) to 2^(LogN/2 + 3) partitions, at least 2^MIN_LOG_PART_NUM, and reports the partitioning with the lowest cost per query
+whose client storage fits the memory budget. The cost is the amortized time for the one server variant and the online time for the two server variant,
+whose offline phase runs only once. Lambda is kept at its configured value since it trades correctness, not only time and storage.
+Partitionings that leave more than MAX_INVALID_RATE of the hints without a cutoff are reported but not picked: those hints are lost, which lowers the effective lambda.
+*/
+void run_tune(Options options)
+{
+	bool new_file = access(options.OutputFile.c_str(), F_OK) == -1;
+	ofstream tune_csv(options.OutputFile, ofstream::out | ofstream::app);
+	if (new_file){
+		tune_csv << "Variant, Log2 DBSize, EntrySize(Bytes), Log2 PartNum, Lambda, Client Storage (MiB), Invalid Hints (%), NumQueries, Dist, Reps";
+		for (const char *column : SummaryColumns)
+			tune_csv << ", " << column << " Mean, " << column << " CI95";
+		tune_csv << endl;
+	}
+
+	uint32_t LogN = options.Log2DBSize;
+	uint32_t lo = max(LogN / 2, MIN_LOG_PART_NUM + 3u) - 3;
+	uint32_t hi = min(LogN / 2 + 3, LogN - 1);
+	uint32_t best = 0;
+	double best_cost = 0;
+	for (uint32_t log_parts = lo; log_parts <= hi; log_parts++){
+		options.LogPartNum = log_parts;
+		string error = geometry_error(options, LogN);
+		if (!error.empty()){
+			cout << "== 2^" << log_parts << " partitions: " << error << ", skipped ==" << endl << endl;
+			continue;
+		}
+		Geometry geo(log_parts, options.Lambda, options.Wide);
+		uint64_t storage = options.OneSV ? OneSVClient::storageBytes(LogN, options.EntrySize, geo) : TwoSVClient::storageBytes(LogN, options.EntrySize, geo);
+		cout << "== 2^" << log_parts << " partitions, client storage " << storage / 1048576.0 << " MiB ==" << endl;
+		if (options.MemoryBudget && storage > options.MemoryBudget){
+			cout << "Over the memory budget, skipped" << endl << endl;
+			continue;
+		}
+		RunSummary summary;
+		ostringstream means;
+		double mean[5];
+		run_reps(options, "2^" + to_string(log_parts) + " partitions", means, summary, mean);
+		tune_csv << (options.OneSV ? "One server" : "Two server") << ", " << LogN << ", " << options.EntrySize << ", " << log_parts << ", " << geo.resolve(LogN).Lambda
+						 << ", " << storage / 1048576.0 << ", " << summary.InvalidRate * 100 << ", " << summary.NumQueries << ", " << QueryStream::distName(options.Dist) << ", " << options.Reps << means.str();
+		cout << "Invalid hint rate: " << summary.InvalidRate * 100 << "%" << endl;
+		if (summary.InvalidRate > MAX_INVALID_RATE){
+			cout << "Too many invalid hints, not considered" << endl << endl;
+			continue;
+		}
+		cout << endl;
+		double cost = options.OneSV ? mean[2] : mean[1];
+		if (!best || cost < best_cost){
+			best = log_parts;
+			best_cost = cost;
+		}
+	}
+	if (!best){
+		cout << "No partitioning fits the memory budget with few enough invalid hints" << endl;
+		return;
+	}
+	cout << "Best partitioning: --log-parts " << best << " (" << best_cost << " ms per query)" << endl;
+}
+
 int main(int argc, char *argv[]){
 
 	Options options = parse_options(argc, argv);
+	if (options.Sweep){
+		run_sweep(options);
+		return 0;
+	}
+	if (options.Tune){
+		run_tune(options);
+		return 0;
+	}
 
 	ofstream output_csv;
 	// If output file doesn't exist then add the headers
 	if (access(options.OutputFile.c_str(), F_OK) == -1){
 		output_csv.open(options.OutputFile);
-		output_csv << "Variant, Log2 DBSize, EntrySize(Bytes), NumQueries, Offline Time (s), Online Time (ms),  Amortized Compute Time Per Query (ms)" <<endl;
+		output_csv << "Variant, Log2 DBSize, EntrySize(Bytes), NumQueries, Offline Time (s), Online Time (ms),  Amortized Compute Time Per Query (ms), Dist, Rate (qps)";
+		for (string stage : {"Total", "Generate", "Answer", "Replenish"})
+			for (string p : {"p50", "p90", "p99", "p999"})
+				output_csv << ", " << stage << " " << p << " (ms)";
+		for (string stage : {"Offline", "Generate", "Answer", "Replenish"})
+			for (const char *column : PerfColumns)
+				output_csv << ", " << stage << " " << column << (stage == "Offline" ? "" : " Per Query");
+		output_csv << endl;
 	} else {
 		output_csv.open(options.OutputFile, ofstream::out | ofstream::app);
 	}
 
 	if (options.OneSV){
-		test_pir<OneSVClient, OneSVServer> (options.Log2DBSize, options.EntrySize, output_csv);
+		test_pir<OneSVClient, OneSVServer> (options, output_csv);
 	} else {
-		test_pir<TwoSVClient, TwoSVServer> (options.Log2DBSize, options.EntrySize, output_csv);
+		test_pir<TwoSVClient, TwoSVServer> (options, output_csv);
 	}
 	output_csv.close();
 }
\ No newline at end of file
@@ -0,0 +1,90 @@
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+#include "metrics.h"
+
+bool Metrics::Enabled = true;
+atomic<uint64_t> Metrics::gauges[Metrics::NumGauges];
+
+static mutex registryLock;
+static vector<Metrics::Block*> registry; // Blocks outlive their threads so their counts stay in snapshots
+
+static const char *CounterNames[] = {
+	"hint_searches", "hints_scanned", "invalid_hints", "backup_used_again", "backup_hints_skipped",
+	"db_bytes_offline", "db_bytes_online", "db_bytes_replenish"
+};
+static const char *GaugeNames[] = {"backup_hints_left"};
+static const char *TimerNames[] = {
+	"client_offline", "client_generate", "client_answer", "client_replenish",
+	"server_answer", "server_replenish", "server_offline_hints"
+};
+
+Metrics::Block *Metrics::registerBlock() {
+	Block *block = new Block();
+	lock_guard<mutex> guard(registryLock);
+	registry.push_back(block);
+	return block;
+}
+
+Metrics::Snapshot Metrics::snapshot() {
+	Snapshot s = {};
+	lock_guard<mutex> guard(registryLock);
+	for (Block *b : registry) {
+		for (int i = 0; i < NumCounters; i++)
+			s.counters[i] += b->counters[i].load(memory_order_relaxed);
+		for (int i = 0; i < NumTimers; i++) {
+			s.timerNs[i] += b->timerNs[i].load(memory_order_relaxed);
+			s.timerCount[i] += b->timerCount[i].load(memory_order_relaxed);
+		}
+	}
+	for (int i = 0; i < NumGauges; i++)
+		s.gauges[i] = gauges[i].load(memory_order_relaxed);
+	return s;
+}
+
+void Metrics::reset() {
+	lock_guard<mutex> guard(registryLock);
+	for (Block *b : registry) {
+		for (int i = 0; i < NumCounters; i++)
+			b->counters[i].store(0, memory_order_relaxed);
+		for (int i = 0; i < NumTimers; i++) {
+			b->timerNs[i].store(0, memory_order_relaxed);
+			b->timerCount[i].store(0, memory_order_relaxed);
+		}
+	}
+	for (int i = 0; i < NumGauges; i++)
+		gauges[i].store(0, memory_order_relaxed);
+}
+
+string Metrics::prometheus() {
+	Snapshot s = snapshot();
+	ostringstream out;
+	for (int i = 0; i < NumCounters; i++)
+		out << "# TYPE s3pir_" << CounterNames[i] << "_total counter\n"
+				<< "s3pir_" << CounterNames[i] << "_total " << s.counters[i] << "\n";
+	for (int i = 0; i < NumGauges; i++)
+		out << "# TYPE s3pir_" << GaugeNames[i] << " gauge\n"
+				<< "s3pir_" << GaugeNames[i] << " " << s.gauges[i] << "\n";
+	out << "# TYPE s3pir_phase_seconds summary\n";
+	for (int i = 0; i < NumTimers; i++)
+		out << "s3pir_phase_seconds_sum{phase=\"" << TimerNames[i] << "\"} " << s.timerNs[i] / 1e9 << "\n"
+				<< "s3pir_phase_seconds_count{phase=\"" << TimerNames[i] << "\"} " << s.timerCount[i] << "\n";
+	return out.str();
+}
+
+string Metrics::json() {
+	Snapshot s = snapshot();
+	ostringstream out;
+	out << "{\n  \"counters\": {";
+	for (int i = 0; i < NumCounters; i++)
+		out << (i ? ", " : "") << "\"" << CounterNames[i] << "\": " << s.counters[i];
+	out << "},\n  \"gauges\": {";
+	for (int i = 0; i < NumGauges; i++)
+		out << (i ? ", " : "") << "\"" << GaugeNames[i] << "\": " << s.gauges[i];
+	out << "},\n  \"timers\": {";
+	for (int i = 0; i < NumTimers; i++)
+		out << (i ? ", " : "") << "\"" << TimerNames[i] << "\": {\"ns\": " << s.timerNs[i] << ", \"count\": " << s.timerCount[i] << "}";
+	out << "}\n}\n";
+	return out.str();
+}
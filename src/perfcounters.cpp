@@ -0,0 +1,109 @@
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "perfcounters.h"
+
+static int perf_event_open(perf_event_attr *attr, int group_fd)
+{
+	// Count the calling thread on any CPU, user space only so that it works with perf_event_paranoid <= 2
+	return syscall(__NR_perf_event_open, attr, 0, -1, group_fd, 0);
+}
+
+PerfCounters::PerfCounters() : Leader(-1), Count(0), Current(-1) {
+	memset(Totals, 0, sizeof(Totals));
+	memset(Occurrences, 0, sizeof(Occurrences));
+	memset(Last, 0, sizeof(Last));
+
+	const uint32_t types[NumEvents] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE};
+	const uint64_t configs[NumEvents] = {
+		PERF_COUNT_HW_CPU_CYCLES,
+		PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_COUNT_HW_CACHE_MISSES,
+		PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+	};
+	for (int e = 0; e < NumEvents; e++){
+		Fds[e] = -1;
+		Index[e] = -1;
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = types[e];
+		attr.config = configs[e];
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.disabled = Leader < 0;
+		attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		int fd = perf_event_open(&attr, Leader);
+		if (fd < 0)
+			continue;
+		Fds[e] = fd;
+		Index[e] = Count++;
+		if (Leader < 0)
+			Leader = fd;
+	}
+	if (Leader >= 0 && ioctl(Leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP) != 0){
+		for (int e = 0; e < NumEvents; e++){
+			if (Fds[e] >= 0)
+				close(Fds[e]);
+			Fds[e] = -1;
+			Index[e] = -1;
+		}
+		Count = 0;
+	}
+}
+
+PerfCounters::~PerfCounters() {
+	for (int e = 0; e < NumEvents; e++)
+		if (Fds[e] >= 0)
+			close(Fds[e]);
+}
+
+bool PerfCounters::read(uint64_t *values) {
+	// Layout of a PERF_FORMAT_GROUP read: nr, time_enabled, time_running, one value per event
+	uint64_t buf[3 + NumEvents];
+	if (::read(Leader, buf, sizeof(buf)) < (ssize_t) ((3 + Count) * sizeof(uint64_t)))
+		return false;
+	// The kernel multiplexes the group when it has fewer counters than events, scale up to the full time enabled
+	double scale = buf[2] ? (double) buf[1] / buf[2] : 0;
+	for (int e = 0; e < NumEvents; e++)
+		values[e] = Index[e] >= 0 ? (uint64_t) (buf[3 + Index[e]] * scale) : 0;
+	return true;
+}
+
+void PerfCounters::mark() {
+	uint64_t now[NumEvents];
+	if (!read(now))
+		return;
+	if (Current >= 0)
+		for (int e = 0; e < NumEvents; e++)
+			Totals[Current][e] += now[e] > Last[e] ? now[e] - Last[e] : 0;
+	memcpy(Last, now, sizeof(Last));
+}
+
+void PerfCounters::begin(Phase p) {
+	if (!available())
+		return;
+	mark();
+	Current = p;
+	Occurrences[p]++;
+}
+
+void PerfCounters::end() {
+	if (Current < 0)
+		return;
+	mark();
+	Current = -1;
+}
+
+const char *PerfCounters::eventName(Event e) {
+	static const char *names[NumEvents] = {"Cycles", "Instructions", "LLC Misses", "dTLB Misses"};
+	return names[e];
+}
+
+const char *PerfCounters::phaseName(Phase p) {
+	static const char *names[NumPhases] = {"Offline", "Generate", "Answer", "Replenish"};
+	return names[p];
+}
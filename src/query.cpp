@@ -0,0 +1,30 @@
+#include "query.h"
+
+void QueryBuilder::init(Arena &arena, uint32_t PartNum, uint32_t PartSize) {
+	this->PartNum = PartNum;
+	this->PartSize = PartSize;
+	uint32_t padded = (PartNum + 7) / 8 * 8;
+	SelectVals = arena.alloc<uint32_t>(padded);
+	Offsets = arena.alloc<uint32_t>(padded);
+	Dummies = arena.alloc<uint32_t>(padded);
+	BlockIn = arena.alloc<uint32_t>(4 * padded);
+	BlockOut = arena.alloc<uint32_t>(4 * padded);
+}
+
+void QueryBuilder::build(uint32_t cutoff, bool flip, bool indicator, bool shouldFlip, uint32_t queryPart, uint64_t extraIdx, bool *bvec, uint32_t *Svec) {
+	uint32_t mask = PartSize - 1;
+	for (uint32_t k = 0; k < PartNum; k++)
+	{
+		bool b = (SelectVals[k] < cutoff) ^ flip;
+		uint32_t real = -(uint32_t) (b == indicator);	// all ones if the real offset is sent
+		bvec[k] = b ^ shouldFlip;
+		Svec[k] = ((Offsets[k] & real) | (Dummies[k] & ~real)) & mask;
+	}
+
+	// The extra partition is patched first since it can coincide with the query's partition, which takes precedence.
+	uint32_t extraPart = extraIdx / PartSize;
+	bvec[extraPart] = indicator ^ shouldFlip;	// real
+	Svec[extraPart] = extraIdx & mask;
+	bvec[queryPart] = (!indicator) ^ shouldFlip;	// dummy
+	Svec[queryPart] = Dummies[queryPart] & mask;
+}
@@ -2,62 +2,91 @@
 
 #include "server.h"
 #include "utils.h"
+#include "metrics.h"
 
-TwoSVServer::TwoSVServer(uint64_t * DB_ptr, uint32_t LogN, uint32_t EntryB): 
+TwoSVServer::TwoSVServer(uint64_t * DB_ptr, uint32_t LogN, uint32_t EntryB, DiskDB * disk, DBGenerator * lazy, Geometry geo): 
  prf(AES_KEY){
-  assert(LogN < 32);
+  assert(LogN <= MAX_LOG_N);
   assert(EntryB >= 8);
-  N = 1 << LogN;
+  N = (uint64_t) 1 << LogN;
+	geo = geo.resolve(LogN);
+	prf.setWide(geo.Wide);
   B = EntryB / 8;
 	EntrySize = EntryB;
   DB = DB_ptr;
-	PartNum = 1 << (LogN / 2);
-	PartSize = 1 << (LogN / 2 + LogN % 2);
-	lambda = LAMBDA;
+	PartNum = 1u << geo.LogPartNum;
+	PartSize = 1u << (LogN - geo.LogPartNum);
+	lambda = geo.Lambda;
 	M = lambda * PartSize;
-	tmpEntry = new uint64_t[B];
+	tmpEntry = arena.alloc<uint64_t>(B);
+	Disk = disk;
+	Lazy = lazy;
+	batchIdx = arena.alloc<uint64_t>(PartNum);
+	batchBuf = arena.alloc<uint64_t>((uint64_t) PartNum * B);
+	prfSelectVals = arena.alloc<uint32_t>(PartNum);
+	prfSelectValsCopy = arena.alloc<uint32_t>(PartNum);
 }
 
 
-void TwoSVServer::getEntryFromServer(uint32_t index, uint64_t *result)
+void TwoSVServer::getEntryFromServer(uint64_t index, uint64_t *result)
 {
+	if (Disk){
+		Disk->readEntry(index, result);
+		return;
+	}
+	if (Lazy){
+		Lazy->entry(index, result);
+		return;
+	}
 #ifdef SimLargeServer
-	memcpy(result, ((uint8_t*) DB) + index, EntrySize);	
+	memcpy(result, ((uint8_t*) DB) + index / EntrySize * EntrySize, EntrySize);	
 #else
 	memcpy(result, DB + index * B, EntrySize); 
 #endif	
-	return;
-	uint64_t dummyData = index;
-	dummyData <<= 1;
-	for (uint32_t l = 0; l < EntrySize / 8; l++)
-		result[l] = dummyData + l; 
 }
 
 void TwoSVServer::replenishHint(uint64_t hintID, uint64_t * result, uint32_t * SelectCutoff){
 	
 	// Run server side part of Algorithm 3.
+	METRICS_SCOPED_TIMER(ServerReplenish);
+	METRICS_ADD(DBBytesReplenish, (uint64_t) PartNum * EntrySize);
 	memset(result, 0, 2*B*sizeof(uint64_t));
-	uint64_t entry[B]; 
-	uint16_t prfIndices[8];
-	uint32_t prfSelectVals[PartNum];
+	uint64_t *entry = tmpEntry; 
+	uint32_t prfIndices[8];
+	uint32_t s = prf.idxShift();
+	uint32_t lane = (1 << s) - 1;
 	
 	for (uint32_t k = 0; k < PartNum; k+=4){
 		prf.evaluate((uint8_t*) (prfSelectVals + k), hintID, k/4, 1);
 	}
 
 	// Get median of selectvals
-	uint32_t prfSelectValsCopy[PartNum];
 	memcpy(prfSelectValsCopy, prfSelectVals, PartNum*sizeof(uint32_t));
 	*SelectCutoff = FindCutoff(prfSelectValsCopy, PartNum);
+	METRICS_ADD(InvalidHints, !*SelectCutoff);
 	
-	for (uint32_t k = 0; k < PartNum; k++){
-		if (k % 8 == 0){
-			prf.evaluate((uint8_t*)prfIndices, hintID, k / 8, 2);
+	if (Disk){
+		for (uint32_t k = 0; k < PartNum; k++){
+			if ((k & lane) == 0){
+				prf.evaluateIdx(prfIndices, hintID, k >> s, 2);
+			}
+			batchIdx[k] = (uint64_t) k * PartSize + (prfIndices[k & lane] & (PartSize - 1));
 		}
+		Disk->readBatch(batchIdx, PartNum, batchBuf);
+	}
+
+	for (uint32_t k = 0; k < PartNum; k++){
 		bool b = prfSelectVals[k] < *SelectCutoff;
-		uint16_t idx = prfIndices[k%8] & (PartSize - 1);
-		getEntryFromServer(k*PartSize + idx, entry);
-		
+		if (Disk){
+			// The batch was read with the offsets evaluated above
+			memcpy(entry, batchBuf + k * B, EntrySize);
+		} else {
+			if ((k & lane) == 0){
+				prf.evaluateIdx(prfIndices, hintID, k >> s, 2);
+			}
+			uint32_t idx = prfIndices[k & lane] & (PartSize - 1);
+			getEntryFromServer((uint64_t) k*PartSize + idx, entry);
+		}
 
 		if (b){
 			for (uint32_t l = 0; l < B; l++){
@@ -71,12 +100,15 @@ void TwoSVServer::replenishHint(uint64_t hintID, uint64_t * result, uint32_t * S
 	}
 }
 
-void TwoSVServer::generateOfflineHints(uint32_t M, uint64_t * Parity, uint16_t * ExtraPart, uint16_t * ExtraOffset, uint32_t * SelectCutoff ){
+void TwoSVServer::generateOfflineHints(uint32_t M, uint64_t * Parity, HintMeta * Hints, uint16_t * ExtraHi){
 
 	// Run Algorithm 1.
-	uint16_t prfIndices [8];
-	uint32_t prfSelectVals[PartNum];
+	METRICS_SCOPED_TIMER(ServerOfflineHints);
+	uint32_t prfIndices [8];
+	uint32_t s = prf.idxShift();
+	uint32_t lane = (1 << s) - 1;
 	uint32_t InvalidHints = 0;
+	uint64_t EntriesRead = 0;
 	// Compute our hints
 	for (uint32_t hint_number = 0; hint_number < M; hint_number++)
 	{
@@ -84,51 +116,65 @@ void TwoSVServer::generateOfflineHints(uint32_t M, uint64_t * Parity, uint16_t *
 			prf.evaluate((uint8_t*) (prfSelectVals + k), hint_number, k / 4, 1);
 		}
 
-		uint32_t prfSelectValsCopy[PartNum];
-
 		memcpy(prfSelectValsCopy, prfSelectVals, PartNum * sizeof(uint32_t));
 		uint32_t cutoff = FindCutoff(prfSelectValsCopy, PartNum);
 		InvalidHints += !cutoff;
-		SelectCutoff[hint_number] = cutoff;
+		Hints[hint_number].Cutoff = cutoff;
 
 		// Choose extra index
-		uint16_t ePart;
+		uint32_t ePart;
 		bool b = 1;
 		while (b) {
 			ePart = NextDummyIdx() % PartNum;
 			b = prfSelectVals[ePart] < cutoff;
 		}
-		uint16_t eIdx = NextDummyIdx() % PartSize;
-		ExtraPart[hint_number] = ePart;
-		ExtraOffset[hint_number] = eIdx;
-		getEntryFromServer(ePart*PartSize + eIdx, Parity + hint_number*B);
+		uint32_t eIdx = NextDummyIdx() % PartSize;
+		setHintExtra(Hints, ExtraHi, hint_number, (uint64_t) ePart*PartSize + eIdx, 1);
+		getEntryFromServer((uint64_t) ePart*PartSize + eIdx, Parity + (uint64_t) hint_number*B);
 		
 		for (uint32_t part_number = 0; part_number < PartNum; part_number++) {
-			if (part_number % 8 == 0){
-				prf.evaluate((uint8_t*) prfIndices, hint_number, part_number / 8, 2);
+			if ((part_number & lane) == 0){
+				prf.evaluateIdx(prfIndices, hint_number, part_number >> s, 2);
 			}
 			if (prfSelectVals[part_number] < cutoff){
-				getEntryFromServer((prfIndices[part_number % 8] & (PartSize - 1)) + part_number * PartSize, tmpEntry);
+				getEntryFromServer((prfIndices[part_number & lane] & (PartSize - 1)) + (uint64_t) part_number * PartSize, tmpEntry);
+				EntriesRead++;
 				for (uint32_t l = 0; l < B; l++)
-					Parity[hint_number*B+l] ^= tmpEntry[l];
+					Parity[(uint64_t) hint_number*B+l] ^= tmpEntry[l];
 			}
 		}
 	}
+	METRICS_ADD(InvalidHints, InvalidHints);
+	METRICS_ADD(DBBytesOffline, (EntriesRead + M) * EntrySize);
 	cout << "Invalid hints: " << InvalidHints << endl;
 }
 
-uint16_t TwoSVServer::NextDummyIdx()
+uint32_t TwoSVServer::NextDummyIdx()
 {
-	if (dummyIdxUsed % 8 == 0)	// need more dummy indices
-		prf.evaluate((uint8_t*) prfDummyIndices, 0, dummyIdxUsed / 8, 0);
-	return prfDummyIndices[dummyIdxUsed++ % 8]; 
+	uint32_t s = prf.idxShift();
+	uint32_t lane = dummyIdxUsed & ((1 << s) - 1);
+	if (lane == 0)	// need more dummy indices
+		prf.evaluateDummyIdx(prfDummyIndices, dummyIdxUsed >> s);
+	dummyIdxUsed++;
+	return prfDummyIndices[lane]; 
 }
 
 
 void TwoSVServer::onlineQuery(bool * bvec, uint32_t *Svec, uint64_t *b0, uint64_t *b1){
+	METRICS_SCOPED_TIMER(ServerAnswer);
+	METRICS_ADD(DBBytesOnline, (uint64_t) PartNum * EntrySize);
+	// A disk-backed database fetches all PartNum entries in one batch up front.
+	if (Disk){
+		for (uint32_t k = 0; k < PartNum; k++)
+			batchIdx[k] = (uint64_t) k * PartSize + Svec[k];
+		Disk->readBatch(batchIdx, PartNum, batchBuf);
+	}
 	for (uint32_t k = 0; k < PartNum; k++)
 	{
-		getEntryFromServer(k * PartSize + Svec[k], tmpEntry);
+		if (Disk)
+			memcpy(tmpEntry, batchBuf + k * B, EntrySize);
+		else
+			getEntryFromServer((uint64_t) k * PartSize + Svec[k], tmpEntry);
 		if (bvec[k])
 			for (uint32_t l = 0; l < B; l++)
 				b1[l] ^= tmpEntry[l];
@@ -138,28 +184,55 @@ void TwoSVServer::onlineQuery(bool * bvec, uint32_t *Svec, uint64_t *b0, uint64_
 	}
 }
 
-OneSVServer::OneSVServer(uint64_t * DB_ptr, uint32_t LogN, uint32_t EntryB){
-  assert(LogN < 32);
+OneSVServer::OneSVServer(uint64_t * DB_ptr, uint32_t LogN, uint32_t EntryB, DiskDB * disk, DBGenerator * lazy, Geometry geo){
+  assert(LogN <= MAX_LOG_N);
   assert(EntryB >= 8);
-  N = 1 << LogN;
+  N = (uint64_t) 1 << LogN;
+	geo = geo.resolve(LogN);
   B = EntryB / 8;
 	EntrySize = EntryB;
   DB = DB_ptr;
-	PartNum = 1 << (LogN / 2);
-	PartSize = 1 << (LogN / 2 + LogN % 2);
-	lambda = LAMBDA;
+	PartNum = 1u << geo.LogPartNum;
+	PartSize = 1u << (LogN - geo.LogPartNum);
+	lambda = geo.Lambda;
 	M = lambda * PartSize;
-  tmpEntry = new uint64_t[B];
+  tmpEntry = arena.alloc<uint64_t>(B);
+	Disk = disk;
+	Lazy = lazy;
+	batchIdx = arena.alloc<uint64_t>(PartNum);
+	batchBuf = arena.alloc<uint64_t>((uint64_t) PartNum * B);
 }
 
-void OneSVServer::getEntry(uint32_t index, uint64_t *result){
+void OneSVServer::getEntry(uint64_t index, uint64_t *result){
+	METRICS_ADD(DBBytesOffline, EntrySize);
+	if (Disk){
+		Disk->readEntry(index, result);
+		return;
+	}
+	if (Lazy){
+		Lazy->entry(index, result);
+		return;
+	}
   getEntryFromDB(DB, index, result, EntrySize);
 }
 
 void OneSVServer::onlineQuery(bool* bvec, uint32_t *Svec, uint64_t *b0, uint64_t *b1){
+	METRICS_SCOPED_TIMER(ServerAnswer);
+	METRICS_ADD(DBBytesOnline, (uint64_t) PartNum * EntrySize);
+	// A disk-backed database fetches all PartNum entries in one batch up front.
+	if (Disk){
+		for (uint32_t k = 0; k < PartNum; k++)
+			batchIdx[k] = (uint64_t) k * PartSize + Svec[k];
+		Disk->readBatch(batchIdx, PartNum, batchBuf);
+	}
 	for (uint32_t k = 0; k < PartNum; k++)
 	{
-		getEntryFromDB(DB, k * PartSize + Svec[k], tmpEntry, EntrySize);
+		if (Disk)
+			memcpy(tmpEntry, batchBuf + k * B, EntrySize);
+		else if (Lazy)
+			Lazy->entry((uint64_t) k * PartSize + Svec[k], tmpEntry);
+		else
+			getEntryFromDB(DB, (uint64_t) k * PartSize + Svec[k], tmpEntry, EntrySize);
 		if (bvec[k])
 			for (uint32_t l = 0; l < B; l++)
 				b1[l] ^= tmpEntry[l];
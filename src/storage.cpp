@@ -0,0 +1,213 @@
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef USE_LIBURING
+#include <liburing.h>
+#endif
+
+#include "storage.h"
+
+#define DISK_BLOCK 4096
+#define MAX_BATCH 4096
+
+// Reads at least Need of the Len bytes at offset into buf, continuing after short reads. Exits on an I/O error or if the file ends first.
+static void readAtLeast(int fd, uint8_t *buf, size_t Len, size_t Need, uint64_t offset)
+{
+	size_t got = 0;
+	while (got < Need) {
+		ssize_t r = pread(fd, buf + got, Len - got, offset + got);
+		if (r < 0 && (errno == EINTR || errno == EAGAIN))
+			continue;
+		if (r <= 0) {
+			cout << "Failed to read the database file: " << (r < 0 ? strerror(errno) : "unexpected end of file") << endl;
+			exit(1);
+		}
+		got += r;
+	}
+}
+
+DiskDB::DiskDB(string path, uint32_t LogN, uint32_t EntryB, uint32_t CachedParts, bool DirectIO, uint32_t LogPartNum) {
+	assert(EntryB >= 8);
+	B = EntryB / 8;
+	EntrySize = EntryB;
+	LogPartNum = Geometry(LogPartNum).resolve(LogN).LogPartNum;
+	PartSize = 1u << (LogN - LogPartNum);
+	Direct = DirectIO;
+	CacheHits = 0;
+	DiskReads = 0;
+
+	int flags = O_RDONLY;
+#ifdef O_DIRECT
+	if (Direct)
+		flags |= O_DIRECT;
+#endif
+	fd = open(path.c_str(), flags);
+	if (fd < 0) {
+		cout << "Failed to open database file " << path << endl;
+		exit(1);
+	}
+	struct stat st;
+	fstat(fd, &st);
+	assert((uint64_t) st.st_size >= ((uint64_t) EntrySize << LogN));
+	if (!Direct)
+		posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+
+	// Entries never straddle more than SpanSize bytes of aligned blocks.
+	SpanSize = ((EntrySize + DISK_BLOCK - 1) / DISK_BLOCK + 1) * DISK_BLOCK;
+	BatchCap = MAX_BATCH;
+	Bounce = nullptr;
+	if (Direct)
+		Bounce = arena.alloc<uint8_t>((size_t) SpanSize * BatchCap, DISK_BLOCK);
+	Pending = arena.alloc<uint64_t>(BatchCap);
+
+	// Pin the hot partitions in memory.
+	uint32_t PartNum = 1u << LogPartNum;
+	CachedEntries = (uint64_t) min(CachedParts, PartNum) * PartSize;
+	Cache = arena.alloc<uint64_t>(CachedEntries * B);
+	for (uint64_t i = 0; i < CachedEntries; i++)
+		readFromDisk(i, Cache + i * B);
+
+	Ring = nullptr;
+#ifdef USE_LIBURING
+	Ring = arena.alloc<io_uring>(1);
+	if (io_uring_queue_init(BatchCap, Ring, 0) < 0) {
+		cout << "io_uring unavailable, falling back to pread" << endl;
+		Ring = nullptr;
+	}
+#endif
+}
+
+DiskDB::~DiskDB() {
+#ifdef USE_LIBURING
+	if (Ring)
+		io_uring_queue_exit(Ring);
+#endif
+	close(fd);
+}
+
+void DiskDB::readFromDisk(uint64_t index, uint64_t *result) {
+	uint64_t offset = index * EntrySize;
+	if (!Direct) {
+		readAtLeast(fd, (uint8_t*) result, EntrySize, EntrySize, offset);
+		return;
+	}
+	// The span may run past the end of the file, only the part up to the end of the entry is needed
+	uint64_t start = offset & ~((uint64_t) DISK_BLOCK - 1);
+	readAtLeast(fd, Bounce, SpanSize, offset - start + EntrySize, start);
+	memcpy(result, Bounce + (offset - start), EntrySize);
+}
+
+void DiskDB::readEntry(uint64_t index, uint64_t *result) {
+	if (index < CachedEntries) {
+		memcpy(result, Cache + index * B, EntrySize);
+		CacheHits++;
+		return;
+	}
+	readFromDisk(index, result);
+	DiskReads++;
+}
+
+void DiskDB::readBatch(const uint64_t *indices, uint32_t Count, uint64_t *result) {
+	auto start = chrono::high_resolution_clock::now();
+
+	for (uint32_t base = 0; base < Count; base += BatchCap) {
+		uint32_t n = min(BatchCap, Count - base);
+
+		// Serve what we can from the cache, collect the rest.
+		uint32_t numPending = 0;
+		for (uint32_t i = base; i < base + n; i++) {
+			if (indices[i] < CachedEntries) {
+				memcpy(result + i * B, Cache + indices[i] * B, EntrySize);
+				CacheHits++;
+			} else {
+				Pending[numPending++] = i;
+			}
+		}
+		DiskReads += numPending;
+
+		if (!Ring) {
+			for (uint32_t p = 0; p < numPending; p++)
+				readFromDisk(indices[Pending[p]], result + Pending[p] * B);
+			continue;
+		}
+
+#ifdef USE_LIBURING
+		// Submit every pending read at once, then wait for all completions.
+		for (uint32_t p = 0; p < numPending; p++) {
+			uint32_t i = Pending[p];
+			uint64_t offset = indices[i] * EntrySize;
+			io_uring_sqe *sqe = io_uring_get_sqe(Ring);
+			if (Direct)
+				io_uring_prep_read(sqe, fd, Bounce + (size_t) p * SpanSize, SpanSize, offset & ~((uint64_t) DISK_BLOCK - 1));
+			else
+				io_uring_prep_read(sqe, fd, result + i * B, EntrySize, offset);
+			io_uring_sqe_set_data(sqe, (void*) (uintptr_t) p);
+		}
+		io_uring_submit_and_wait(Ring, numPending);
+		for (uint32_t done = 0; done < numPending; done++) {
+			io_uring_cqe *cqe;
+			if (io_uring_wait_cqe(Ring, &cqe) < 0) {
+				cout << "Failed to wait for a database read" << endl;
+				exit(1);
+			}
+			int res = cqe->res;
+			uint32_t p = (uintptr_t) io_uring_cqe_get_data(cqe);
+			io_uring_cqe_seen(Ring, cqe);
+			if (res < 0 && res != -EINTR && res != -EAGAIN) {
+				cout << "Failed to read the database file: " << strerror(-res) << endl;
+				exit(1);
+			}
+			// Finish short reads with pread into the same buffer
+			size_t got = max(res, 0);
+			uint32_t i = Pending[p];
+			uint64_t offset = indices[i] * EntrySize;
+			if (Direct) {
+				uint8_t *span = Bounce + (size_t) p * SpanSize;
+				uint64_t start = offset & ~((uint64_t) DISK_BLOCK - 1);
+				size_t need = offset - start + EntrySize;
+				if (got < need)
+					readAtLeast(fd, span + got, SpanSize - got, need - got, start + got);
+				memcpy(result + i * B, span + (offset - start), EntrySize);
+			} else if (got < EntrySize) {
+				readAtLeast(fd, (uint8_t*) (result + i * B) + got, EntrySize - got, EntrySize - got, offset + got);
+			}
+		}
+#endif
+	}
+
+	auto end = chrono::high_resolution_clock::now();
+	Latency.add(chrono::duration_cast<chrono::nanoseconds>(end - start).count());
+}
+
+void DiskDB::writeFile(string path, uint64_t *DB, uint32_t LogN, uint32_t EntryB) {
+	uint64_t N = (uint64_t) 1 << LogN;
+	uint32_t B = EntryB / 8;
+	uint64_t ChunkEntries = min(N, (uint64_t) 1 << 16);
+	uint64_t *chunk = new uint64_t [ChunkEntries * B];
+	ofstream out(path, ofstream::binary | ofstream::trunc);
+	for (uint64_t base = 0; base < N; base += ChunkEntries) {
+		for (uint64_t i = 0; i < ChunkEntries; i++)
+			getEntryFromDB(DB, base + i, chunk + i * B, EntryB);
+		out.write((char*) chunk, ChunkEntries * EntryB);
+	}
+	out.close();
+	delete [] chunk;
+}
+
+void DiskDB::writeFile(string path, DBGenerator &gen, uint32_t LogN, uint32_t EntryB) {
+	uint64_t N = (uint64_t) 1 << LogN;
+	uint32_t B = EntryB / 8;
+	uint64_t ChunkEntries = min(N, (uint64_t) 1 << 16);
+	uint64_t *chunk = new uint64_t [ChunkEntries * B];
+	ofstream out(path, ofstream::binary | ofstream::trunc);
+	for (uint64_t base = 0; base < N; base += ChunkEntries) {
+		gen.fillRange(chunk, base, ChunkEntries);
+		out.write((char*) chunk, ChunkEntries * EntryB);
+	}
+	out.close();
+	delete [] chunk;
+}
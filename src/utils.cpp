@@ -1,35 +1,176 @@
+#include <immintrin.h>
+
 #include "utils.h"
+#include "dbgen.h"
 
-void getEntryFromDB(uint64_t* DB, uint32_t index, uint64_t *result, uint32_t EntrySize)
+void getEntryFromDB(uint64_t* DB, uint64_t index, uint64_t *result, uint32_t EntrySize)
 {
-#ifdef DEBUG
-	uint64_t dummyData = index;
-	dummyData <<= 1;
-	for (uint32_t l = 0; l < EntrySize / 8; l++)
-		result[l] = dummyData + l; 
-	return;
-#endif
-
 	#ifdef SimLargeServer
-		memcpy(result, ((uint8_t*) DB) + index, EntrySize);	
+		// The simulated database holds N / EntrySize entries, entry index is stored entry index / EntrySize
+		memcpy(result, ((uint8_t*) DB) + index / EntrySize * EntrySize, EntrySize);	
 	#else
 		memcpy(result, DB + index * (EntrySize / 8), EntrySize); 
 	#endif	
 };
 
-void initDatabase(uint64_t** DB, uint64_t kLogDBSize, uint64_t kEntrySize){
+uint64_t databaseWords(uint64_t kLogDBSize, uint64_t kEntrySize){
 #ifdef SimLargeServer
-	uint64_t DBSizeInUint64 = ((uint64_t) 1 << (kLogDBSize-3)) + kEntrySize;		
+	return ((uint64_t) 1 << (kLogDBSize-3)) + kEntrySize;		
 #else
-	uint64_t DBSizeInUint64 = ((uint64_t) kEntrySize / 8) << kLogDBSize;
+	return ((uint64_t) kEntrySize / 8) << kLogDBSize;
 #endif	
+}
+
+void initDatabase(uint64_t** DB, uint64_t kLogDBSize, uint64_t kEntrySize, uint64_t Seed){
+	uint64_t DBSizeInUint64 = databaseWords(kLogDBSize, kEntrySize);
 	*DB = new uint64_t [DBSizeInUint64];
-	ifstream frand("/dev/urandom"); 
-	frand.read((char*) *DB, DBSizeInUint64);
-	frand.close();
+	fillDatabase(*DB, kLogDBSize, kEntrySize, Seed);
+}
+
+void fillDatabase(uint64_t* DB, uint64_t kLogDBSize, uint64_t kEntrySize, uint64_t Seed){
+	DBGenerator gen(kEntrySize, Seed);
+	gen.fill(DB, databaseWords(kLogDBSize, kEntrySize) * 8 / kEntrySize);
+}
+
+#define CUTOFF_LOWER (0x80000000u - (1u << 28))
+#define CUTOFF_UPPER (0x80000000u + (1u << 28))
+#define HIST_MIN_VALS 512 // Below this many middle values nth_element is faster than a histogram
+#define HIST_MAX_BITS 12
+
+// Each filter moves the values in [CUTOFF_LOWER, CUTOFF_UPPER] to the front of prfVals, keeping their order, and returns how many there are.
+// LowerCnt and UpperCnt are set to the number of values below and above the band.
+typedef uint32_t (*CutoffFilter)(uint32_t *prfVals, uint32_t PartNum, uint32_t &LowerCnt, uint32_t &UpperCnt);
+
+static uint32_t FilterTail(uint32_t *prfVals, uint32_t k, uint32_t PartNum, uint32_t MiddleCnt, uint32_t &LowerCnt, uint32_t &UpperCnt) {
+	for (; k < PartNum; k++)
+	{
+		if (prfVals[k] < CUTOFF_LOWER)
+			LowerCnt++;
+		else if (prfVals[k] > CUTOFF_UPPER)
+			UpperCnt++;
+		else
+			prfVals[MiddleCnt++] = prfVals[k];
+	}
+	return MiddleCnt;
+}
+
+static uint32_t FilterScalar(uint32_t *prfVals, uint32_t PartNum, uint32_t &LowerCnt, uint32_t &UpperCnt) {
+	LowerCnt = UpperCnt = 0;
+	return FilterTail(prfVals, 0, PartNum, 0, LowerCnt, UpperCnt);
+}
+
+// Compaction stores always land at or before the block being read, so filtering in place is safe.
+__attribute__((target("avx2")))
+static uint32_t FilterAVX2(uint32_t *prfVals, uint32_t PartNum, uint32_t &LowerCnt, uint32_t &UpperCnt) {
+	// Permutation moving the lanes selected by an 8-bit mask to the front.
+	static uint32_t CompressLUT[256][8];
+	static bool LUTReady = [] {
+		for (uint32_t m = 0; m < 256; m++) {
+			uint32_t n = 0;
+			for (uint32_t i = 0; i < 8; i++)
+				if (m >> i & 1)
+					CompressLUT[m][n++] = i;
+			for (; n < 8; n++)
+				CompressLUT[m][n] = 0;
+		}
+		return true;
+	}();
+	(void) LUTReady;
+
+	// AVX2 only has signed compares, so bias everything by 2^31.
+	const __m256i bias = _mm256_set1_epi32(0x80000000);
+	const __m256i lower = _mm256_set1_epi32(CUTOFF_LOWER ^ 0x80000000);
+	const __m256i upper = _mm256_set1_epi32(CUTOFF_UPPER ^ 0x80000000);
+	uint32_t MiddleCnt = 0, k = 0;
+	LowerCnt = UpperCnt = 0;
+	for (; k + 8 <= PartNum; k += 8) {
+		__m256i v = _mm256_loadu_si256((__m256i*) (prfVals + k));
+		__m256i biased = _mm256_xor_si256(v, bias);
+		uint32_t lowMask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(lower, biased)));
+		uint32_t upMask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(biased, upper)));
+		uint32_t midMask = ~(lowMask | upMask) & 0xff;
+		__m256i perm = _mm256_loadu_si256((__m256i*) CompressLUT[midMask]);
+		_mm256_storeu_si256((__m256i*) (prfVals + MiddleCnt), _mm256_permutevar8x32_epi32(v, perm));
+		LowerCnt += __builtin_popcount(lowMask);
+		UpperCnt += __builtin_popcount(upMask);
+		MiddleCnt += __builtin_popcount(midMask);
+	}
+	return FilterTail(prfVals, k, PartNum, MiddleCnt, LowerCnt, UpperCnt);
+}
+
+__attribute__((target("avx512f")))
+static uint32_t FilterAVX512(uint32_t *prfVals, uint32_t PartNum, uint32_t &LowerCnt, uint32_t &UpperCnt) {
+	const __m512i lower = _mm512_set1_epi32(CUTOFF_LOWER);
+	const __m512i upper = _mm512_set1_epi32(CUTOFF_UPPER);
+	uint32_t MiddleCnt = 0, k = 0;
+	LowerCnt = UpperCnt = 0;
+	for (; k + 16 <= PartNum; k += 16) {
+		__m512i v = _mm512_loadu_si512(prfVals + k);
+		__mmask16 lowMask = _mm512_cmplt_epu32_mask(v, lower);
+		__mmask16 upMask = _mm512_cmpgt_epu32_mask(v, upper);
+		__mmask16 midMask = (__mmask16) ~(lowMask | upMask);
+		_mm512_mask_compressstoreu_epi32(prfVals + MiddleCnt, midMask, v);
+		LowerCnt += __builtin_popcount(lowMask);
+		UpperCnt += __builtin_popcount(upMask);
+		MiddleCnt += __builtin_popcount(midMask);
+	}
+	return FilterTail(prfVals, k, PartNum, MiddleCnt, LowerCnt, UpperCnt);
+}
+
+static CutoffFilter ChooseFilter() {
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		return FilterAVX512;
+	if (__builtin_cpu_supports("avx2"))
+		return FilterAVX2;
+	return FilterScalar;
+}
+
+// Returns the rank-th smallest of vals[0, Cnt), or 0 if that value occurs more than once. Reorders vals.
+static uint32_t SelectUnique(uint32_t *vals, uint32_t Cnt, uint32_t rank) {
+	uint32_t *median = vals + rank;
+	nth_element(vals, median, vals + Cnt);
+	uint32_t cutoff = *median;
+	*median = 0;
+	for (uint32_t k = 0; k < Cnt; k++){
+		if (vals[k] == cutoff) return 0;
+	}
+	return cutoff;
 }
 
 uint32_t FindCutoff(uint32_t *prfVals, uint32_t PartNum) {
+	static const CutoffFilter Filter = ChooseFilter();
+
+	uint32_t LowerCnt, UpperCnt;
+	uint32_t MiddleCnt = Filter(prfVals, PartNum, LowerCnt, UpperCnt);
+	if (LowerCnt >= PartNum / 2 || UpperCnt >= PartNum / 2)
+		return 0;	// filtered too many, just give up this hint	
+
+	uint32_t rank = PartNum / 2 - LowerCnt;
+	if (MiddleCnt < HIST_MIN_VALS)
+		return SelectUnique(prfVals, MiddleCnt, rank);
+
+	// The band is uniformly filled, so a histogram with about one value per bucket narrows the median down to a handful of candidates.
+	// Equal values share a bucket, so the duplicate check only needs to look inside it.
+	uint32_t bits = min(31 - __builtin_clz(MiddleCnt), HIST_MAX_BITS);
+	uint32_t shift = 29 - bits;	// prfVals - CUTOFF_LOWER is in [0, 2^29], the last bucket only holds 2^29
+	uint32_t hist[(1 << HIST_MAX_BITS) + 1];
+	memset(hist, 0, sizeof(uint32_t) * ((1 << bits) + 1));
+	for (uint32_t k = 0; k < MiddleCnt; k++)
+		hist[(prfVals[k] - CUTOFF_LOWER) >> shift]++;
+
+	uint32_t bucket = 0, below = 0;
+	while (below + hist[bucket] <= rank)
+		below += hist[bucket++];
+
+	uint32_t BucketCnt = 0;
+	for (uint32_t k = 0; k < MiddleCnt; k++)
+		if (((prfVals[k] - CUTOFF_LOWER) >> shift) == bucket)
+			prfVals[BucketCnt++] = prfVals[k];
+	return SelectUnique(prfVals, BucketCnt, rank - below);
+}
+
+uint32_t FindCutoffScalar(uint32_t *prfVals, uint32_t PartNum) {
 	uint32_t LowerFilter = 0x80000000 - (1 << 28);
 	uint32_t UpperFilter = 0x80000000 + (1 << 28);
 
@@ -61,4 +202,48 @@ uint32_t FindCutoff(uint32_t *prfVals, uint32_t PartNum) {
 		if (prfVals[k] == cutoff) return 0;
 	}
 	return cutoff;
+}
+
+
+uint64_t LatencyStats::percentile(double p) const {
+	if (samples.empty())
+		return 0;
+	vector<uint64_t> sorted(samples);
+	size_t rank = (size_t) (p / 100.0 * (sorted.size() - 1) + 0.5);
+	nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+	return sorted[rank];
+}
+
+void LatencyStats::writeHistogram(ostream &out, const string &prefix) const {
+	vector<uint64_t> counts;
+	for (uint64_t v : samples) {
+		uint32_t bucket = v;
+		if (v >= 8) {
+			uint32_t e = 63 - __builtin_clzll(v);
+			bucket = (e - 2) * 8 + ((v >> (e - 3)) & 7);
+		}
+		if (bucket >= counts.size())
+			counts.resize(bucket + 1);
+		counts[bucket]++;
+	}
+	for (uint32_t bucket = 0; bucket < counts.size(); bucket++) {
+		if (!counts[bucket])
+			continue;
+		uint64_t lower = bucket, width = 1;
+		if (bucket >= 8) {
+			uint32_t e = bucket / 8 + 2;
+			width = (uint64_t) 1 << (e - 3);
+			lower = (8 + bucket % 8) * width;
+		}
+		out << prefix << lower / 1000.0 << ", " << (lower + width) / 1000.0 << ", " << counts[bucket] << endl;
+	}
+}
+
+double LatencyStats::mean() const {
+	if (samples.empty())
+		return 0;
+	double sum = 0;
+	for (uint64_t s : samples)
+		sum += s;
+	return sum / samples.size();
 }
\ No newline at end of file